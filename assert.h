@@ -1,9 +1,9 @@
 //macro to check type of argument to function
 #define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
+  LASSERT(args, LPTR(args->cell[index])->type == expect, \
     "Function '%s' passed incorrect type for argument %i. " \
     "Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+    func, index, ltype_name(LPTR(args->cell[index])->type), ltype_name(expect))
 
 //macro to assert number of arguments to function
 #define LASSERT_NUM(func, args, num) \
@@ -14,5 +14,5 @@
 
 //macro to ensure function arguments not empty
 #define LASSERT_NOT_EMPTY(func, args, index) \
-  LASSERT(args, args->cell[index]->count != 0, \
+  LASSERT(args, LPTR(args->cell[index])->count != 0, \
     "Function '%s' passed {} for argument %i.", func, index);
\ No newline at end of file
@@ -3,20 +3,47 @@ struct lval;
 struct lenv;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lint lint;
 void lval_print(lval* v);
 lval* lval_eval(lenv* e, lval* v);
 lval* lval_pop(lval* v, int i);
 lval* lval_qexpr(void);
 lval* lval_take(lval* v, int i);
 lval* lval_call(lenv* e, lval* f, lval* a);
+lval* lval_apply(lenv* e, lval* f, lval* a);
 lval* builtin(lval* a, char* func);
 lval* lenv_get(lenv* e, lval* k);
 void lenv_put(lenv* e, lval* k, lval* v);
+void lenv_move(lenv* e, lval* k, lval* v);
 char* ltype_name(int t);
 lenv* lenv_new(void);
 void lenv_del(lenv* e);
 lenv* lenv_copy(lenv* e);
 void lenv_def(lenv* e, lval* k, lval* v);
+void lenv_def_move(lenv* e, lval* k, lval* v);
 lval* builtin_var(lenv* e, lval* a, char* func);
 lval* builtin_def(lenv* e, lval* a);
-lval* builtin_eval(lenv* e, lval* a);
\ No newline at end of file
+lval* builtin_eval(lenv* e, lval* a);
+lval* lval_expand_in(lenv* e, lval* v);
+void lenv_unframe(lenv* e);
+void lenv_frame_release(lenv* e);
+lval* lenv_lookup(lenv* e, char* sym);
+lval* lenv_lookup_frame(lenv* e, char* sym);
+lval* builtin_inline(lenv* e, lval* a);
+int lval_is_inline(lval* v);
+lval* lcode_call(lenv* e, lval* f, lval* a);
+void lval_delete(lval* v);
+lval* lval_copy(lval* v);
+
+//native code entry point: arguments and let slots in, result out. Sets
+//*fail when the interpreter has to redo the call, e.g. on division by zero
+typedef long(*ljit_fn)(long* slots, int* fail);
+lval* lval_num(long x);
+lval* lval_err(char* fmt, ...);
+lval* lval_sym(char* s);
+lval* lval_sexpr(void);
+lval* lval_add(lval* v, lval* x);
+void lenv_add_builtins(lenv* e);
+void lval_run(lenv* e, lval* x);
+void lcode_install(lenv* e, char* name, ljit_fn fn, int slots, lval* guards);
+void lint_del(lint* n);
\ No newline at end of file
@@ -122,13 +122,14 @@ void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt, ...)
   va_end(va);
 }
 
-static char char_unescape_buffer[3];
+static char char_unescape_buffer[4];
 
 static const char *mpc_err_char_unescape(char c) {
   
   char_unescape_buffer[0] = '\'';
   char_unescape_buffer[1] = ' ';
   char_unescape_buffer[2] = '\'';
+  char_unescape_buffer[3] = '\0';
   
   switch (c) {
     
@@ -178,7 +179,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
   
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->recieved));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->recieved));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
   
   return realloc(buffer, strlen(buffer) + 1);
@@ -271,6 +272,323 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
   return y;
 }
 
+/*
+** Lazy Errors
+**
+** Failure is the common case while parsing, as
+** most alternatives tried don't match, so errors
+** are not built as `mpc_err_t` while parsing.
+** Instead each failure records its position and
+** the message of the parser that failed, which
+** the parser owns. Combining failures keeps only
+** those furthest into the input, which are all
+** `mpc_err_or` would look at.
+**
+** Only when the whole parse fails is the tree
+** replayed through the `mpc_err_t` functions to
+** build the error for the caller.
+*/
+
+enum {
+  MPC_LERR_EXPECT = 0,
+  MPC_LERR_FAIL   = 1,
+  MPC_LERR_OR     = 2,
+  MPC_LERR_MANY1  = 3,
+  MPC_LERR_COUNT  = 4,
+  MPC_LERR_SPLIT  = 5
+};
+
+typedef struct mpc_lerr_t {
+  char type;
+  char recieved;
+  int refs;
+  int n;
+  mpc_state_t state;
+  const char *m;
+  int xs_num;
+  int xs_slots;
+  struct mpc_lerr_t **xs;
+  struct mpc_lerr_t *xs_inline[2];
+} mpc_lerr_t;
+
+typedef union {
+  mpc_lerr_t *error;
+  mpc_val_t *output;
+} mpc_lresult_t;
+
+static mpc_lerr_t *mpc_lerr_alloc(int type, mpc_state_t s, const char *m, char recieved) {
+  mpc_lerr_t *x = malloc(sizeof(mpc_lerr_t));
+  x->type = type;
+  x->recieved = recieved;
+  x->refs = 1;
+  x->n = 0;
+  x->state = s;
+  x->m = m;
+  x->xs_num = 0;
+  x->xs_slots = 2;
+  x->xs = x->xs_inline;
+  return x;
+}
+
+static mpc_lerr_t *mpc_lerr_new(mpc_state_t s, const char *expected, char recieved) {
+  return mpc_lerr_alloc(MPC_LERR_EXPECT, s, expected, recieved);
+}
+
+static mpc_lerr_t *mpc_lerr_fail(mpc_state_t s, const char *failure) {
+  return mpc_lerr_alloc(MPC_LERR_FAIL, s, failure, ' ');
+}
+
+static mpc_lerr_t *mpc_lerr_copy(mpc_lerr_t *x) {
+  x->refs++;
+  return x;
+}
+
+static void mpc_lerr_delete(mpc_lerr_t *x) {
+  int i;
+  if (--x->refs > 0) { return; }
+  for (i = 0; i < x->xs_num; i++) { mpc_lerr_delete(x->xs[i]); }
+  if (x->xs != x->xs_inline) { free(x->xs); }
+  free(x);
+}
+
+static void mpc_lerr_add(mpc_lerr_t *x, mpc_lerr_t *y) {
+  if (x->xs_num == x->xs_slots) {
+    x->xs_slots *= 2;
+    if (x->xs == x->xs_inline) {
+      x->xs = malloc(sizeof(mpc_lerr_t*) * x->xs_slots);
+      memcpy(x->xs, x->xs_inline, sizeof(mpc_lerr_t*) * x->xs_num);
+    } else {
+      x->xs = realloc(x->xs, sizeof(mpc_lerr_t*) * x->xs_slots);
+    }
+  }
+  x->xs[x->xs_num++] = y;
+}
+
+/*
+** Consumes the `n` errors at `x`. A failure message
+** among the furthest wins, as it does when printed,
+** and a single furthest error stands for itself.
+*/
+
+static mpc_lerr_t *mpc_lerr_or(mpc_lerr_t **x, int n) {
+  
+  int i, j, tied = 0;
+  long pos = x[0]->state.pos;
+  mpc_lerr_t *e = NULL, *f = NULL, *y;
+  
+  for (i = 1; i < n; i++) {
+    if (x[i]->state.pos > pos) { pos = x[i]->state.pos; }
+  }
+  
+  for (i = 0; i < n; i++) {
+    if (x[i]->state.pos < pos) { continue; }
+    if (x[i]->type == MPC_LERR_FAIL) { f = x[i]; break; }
+    tied++;
+  }
+  
+  if (f || tied == 1) {
+    for (i = 0; i < n; i++) {
+      if (x[i]->state.pos < pos) { mpc_lerr_delete(x[i]); continue; }
+      if (e || (f && x[i] != f)) { mpc_lerr_delete(x[i]); continue; }
+      e = x[i];
+    }
+    return e;
+  }
+  
+  e = NULL;
+  for (i = 0; i < n; i++) {
+    y = x[i];
+    if (y->state.pos < pos) { mpc_lerr_delete(y); continue; }
+    if (!e) { e = mpc_lerr_alloc(MPC_LERR_OR, y->state, NULL, ' '); }
+    e->recieved = y->recieved;
+    if ((y->type == MPC_LERR_OR || y->type == MPC_LERR_SPLIT) && y->refs == 1) {
+      for (j = 0; j < y->xs_num; j++) { mpc_lerr_add(e, y->xs[j]); }
+      y->xs_num = 0;
+      mpc_lerr_delete(y);
+    } else {
+      mpc_lerr_add(e, y);
+    }
+  }
+  return e;
+}
+
+static mpc_lerr_t *mpc_lerr_repeat(mpc_lerr_t *x, int type, int n) {
+  mpc_lerr_t *e;
+  if (x->type == MPC_LERR_FAIL) { return x; }
+  e = mpc_lerr_alloc(type, x->state, NULL, x->recieved);
+  e->n = n;
+  mpc_lerr_add(e, x);
+  return e;
+}
+
+/*
+** The errors under another are always at the same
+** place, so only the state at the top is used. That
+** lets `mpc_lerr_at` move an error by its top alone.
+*/
+
+static mpc_lerr_t *mpc_lerr_at(mpc_lerr_t *x, mpc_state_t s) {
+  int i;
+  mpc_lerr_t *e = mpc_lerr_alloc(x->type, s, x->m, x->recieved);
+  e->n = x->n;
+  for (i = 0; i < x->xs_num; i++) { mpc_lerr_add(e, mpc_lerr_copy(x->xs[i])); }
+  return e;
+}
+
+static mpc_err_t *mpc_lerr_err(mpc_lerr_t *x, mpc_state_t s, const char *filename) {
+  
+  int i;
+  mpc_err_t *errs[2], *e = NULL;
+  
+  switch (x->type) {
+    case MPC_LERR_EXPECT: return mpc_err_new(filename, s, x->m, x->recieved);
+    case MPC_LERR_FAIL: return mpc_err_fail(filename, s, x->m);
+    case MPC_LERR_MANY1: return mpc_err_many1(mpc_lerr_err(x->xs[0], s, filename));
+    case MPC_LERR_COUNT: return mpc_err_count(mpc_lerr_err(x->xs[0], s, filename), x->n);
+    case MPC_LERR_OR:
+    case MPC_LERR_SPLIT:
+      e = mpc_lerr_err(x->xs[0], s, filename);
+      for (i = 1; i < x->xs_num; i++) {
+        errs[0] = e;
+        errs[1] = mpc_lerr_err(x->xs[i], s, filename);
+        e = mpc_err_or(errs, 2);
+      }
+      return e;
+    default: return e;
+  }
+}
+
+/*
+** Memo Table
+**
+** Used by `mpc_memo` for packrat parsing. Results
+** are stored per parser and input position in a
+** set associative hash table, which grows up to a
+** byte limit. After that a full set evicts the
+** entry furthest behind in the input, since the
+** parse moves forward and rarely backtracks far.
+*/
+
+enum {
+  MPC_MEMO_WAYS = 4,
+  MPC_MEMO_SETS = 256
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  mpc_state_t start;
+  char last;
+  char backtrack;
+  char success;
+  char end_last;
+  mpc_state_t end;
+  mpc_lresult_t r;
+  mpc_dtor_t d;
+} mpc_memo_entry_t;
+
+typedef struct {
+  int sets_num;
+  int entries_num;
+  mpc_memo_entry_t *entries;
+  int starts_num;
+  int starts_slots;
+  mpc_memo_entry_t *starts;
+} mpc_memo_t;
+
+static size_t mpc_memo_bytes = 16 * 1024 * 1024;
+
+void mpc_memo_limit(size_t bytes) {
+  mpc_memo_bytes = bytes;
+}
+
+static mpc_memo_t *mpc_memo_new(void) {
+  mpc_memo_t *m = malloc(sizeof(mpc_memo_t));
+  m->sets_num = MPC_MEMO_SETS;
+  m->entries_num = 0;
+  m->entries = calloc(MPC_MEMO_SETS * MPC_MEMO_WAYS, sizeof(mpc_memo_entry_t));
+  m->starts_num = 0;
+  m->starts_slots = 0;
+  m->starts = NULL;
+  return m;
+}
+
+static void mpc_memo_entry_delete(mpc_memo_entry_t *e) {
+  if (e->success) {
+    if (e->d) { e->d(e->r.output); }
+  } else {
+    mpc_lerr_delete(e->r.error);
+  }
+  e->p = NULL;
+}
+
+static void mpc_memo_delete(mpc_memo_t *m) {
+  int i;
+  for (i = 0; i < m->sets_num * MPC_MEMO_WAYS; i++) {
+    if (m->entries[i].p) { mpc_memo_entry_delete(&m->entries[i]); }
+  }
+  free(m->entries);
+  free(m->starts);
+  free(m);
+}
+
+static mpc_memo_entry_t *mpc_memo_set(mpc_memo_t *m, mpc_parser_t *p, long pos) {
+  unsigned long h = ((unsigned long)(size_t)p >> 4) ^ ((unsigned long)pos * 2654435761UL);
+  h ^= h >> 15;
+  return m->entries + (h & (m->sets_num - 1)) * MPC_MEMO_WAYS;
+}
+
+static mpc_memo_entry_t *mpc_memo_find(mpc_memo_t *m, mpc_memo_entry_t *k) {
+  int i;
+  mpc_memo_entry_t *e = mpc_memo_set(m, k->p, k->start.pos);
+  for (i = 0; i < MPC_MEMO_WAYS; i++) {
+    if (e[i].p == k->p && e[i].start.pos == k->start.pos &&
+        e[i].last == k->last && e[i].backtrack == k->backtrack) { return &e[i]; }
+  }
+  return NULL;
+}
+
+static void mpc_memo_insert(mpc_memo_t *m, mpc_memo_entry_t *k);
+
+static void mpc_memo_grow(mpc_memo_t *m) {
+  
+  int i, n = m->sets_num * MPC_MEMO_WAYS;
+  mpc_memo_entry_t *old = m->entries;
+  
+  m->sets_num *= 2;
+  m->entries_num = 0;
+  m->entries = calloc(m->sets_num * MPC_MEMO_WAYS, sizeof(mpc_memo_entry_t));
+  for (i = 0; i < n; i++) {
+    if (old[i].p) { mpc_memo_insert(m, &old[i]); }
+  }
+  free(old);
+}
+
+static void mpc_memo_insert(mpc_memo_t *m, mpc_memo_entry_t *k) {
+  
+  int i;
+  mpc_memo_entry_t *e, *v;
+  
+  /* Grow while there is room under the limit */
+  if (m->entries_num >= m->sets_num * MPC_MEMO_WAYS / 2 &&
+      sizeof(mpc_memo_entry_t) * MPC_MEMO_WAYS * m->sets_num * 2 <= mpc_memo_bytes) {
+    mpc_memo_grow(m);
+  }
+  
+  e = mpc_memo_set(m, k->p, k->start.pos);
+  v = &e[0];
+  for (i = 0; i < MPC_MEMO_WAYS; i++) {
+    if (!e[i].p) { v = &e[i]; break; }
+    if (e[i].start.pos < v->start.pos) { v = &e[i]; }
+  }
+  
+  if (v->p) {
+    mpc_memo_entry_delete(v);
+  } else {
+    m->entries_num++;
+  }
+  *v = *k;
+}
+
 /*
 ** Input Type
 */
@@ -279,8 +597,9 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
 ** In mpc the input type has three modes of 
 ** operation: String, File and Pipe.
 **
-** String is easy. The whole contents are 
-** loaded into a buffer and scanned through.
+** String is easy. The caller's buffer is
+** scanned through in place, up to its length,
+** so it needn't be copied or NUL terminated.
 ** The cursor can jump around at will making 
 ** backtracking easy.
 **
@@ -290,15 +609,16 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
 ** by seeking in the file at different positions.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and 
-** only support a single character lookahead at 
-** any point, when the input is marked for a 
-** potential backtracking we start buffering any 
-** input.
+** one. As we assume pipes cannot be seeked,
+** everything read from the pipe goes into a ring
+** buffer, and is dropped again once the cursor
+** has passed it with no mark outstanding.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** buffer instead of the input, while a stream
+** parsed without holding marks across it runs
+** in bounded memory.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
@@ -318,20 +638,35 @@ typedef struct {
   char *filename;  
   mpc_state_t state;
   
-  char *string;
-  char *buffer;
+  const char *string;
+  long length;
   FILE *file;
   
+  char *buffer;
+  long buffer_pos;
+  long buffer_head;
+  long buffer_num;
+  long buffer_slots;
+  
   int backtrack;
   int marks_num;
+  int marks_slots;
   mpc_state_t* marks;
   char* lasts;
   
   char last;
   
+  mpc_memo_t *memo;
+  
+  int spans_num;
+  int spans_slots;
+  mpc_state_t *spans;
+  
+  mpc_ast_arena_t *arena;
+  
 } mpc_input_t;
 
-static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
+static mpc_input_t *mpc_input_new_string(const char *filename, const char *string, long length) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
   
@@ -341,17 +676,29 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->string = string;
+  i->length = length;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_head = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = NULL;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
 
   i->last = '\0';
+  i->memo = NULL;
+  
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->spans = NULL;
+  
+  i->arena = NULL;
   
   return i;
 }
@@ -367,15 +714,28 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_head = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = pipe;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
   
   i->last = '\0';
+  i->memo = NULL;
+  
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->spans = NULL;
+  
+  i->arena = NULL;
   
   return i;
   
@@ -391,15 +751,28 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_head = 0;
+  i->buffer_num = 0;
+  i->buffer_slots = 0;
   i->file = file;
   
   i->backtrack = 1;
   i->marks_num = 0;
+  i->marks_slots = 0;
   i->marks = NULL;
   i->lasts = NULL;
   
   i->last = '\0';
+  i->memo = NULL;
+  
+  i->spans_num = 0;
+  i->spans_slots = 0;
+  i->spans = NULL;
+  
+  i->arena = NULL;
   
   return i;
 }
@@ -408,31 +781,93 @@ static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
   free(i->marks);
   free(i->lasts);
+  if (i->memo) { mpc_memo_delete(i->memo); }
+  free(i->spans);
   free(i);
 }
 
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
+/*
+** Pipe Buffer
+**
+** A ring of `buffer_num` bytes starting at index
+** `buffer_head`, holding the input from position
+** `buffer_pos` onwards. Bytes are read into it
+** from the pipe as the cursor reaches its end, and
+** released from its start once no mark can rewind
+** to them.
+*/
+
+static int mpc_input_buffer_in_range(mpc_input_t *i) {
+  return i->state.pos < i->buffer_pos + i->buffer_num;
+}
+
+static char mpc_input_buffer_get(mpc_input_t *i) {
+  return i->buffer[(i->buffer_head + (i->state.pos - i->buffer_pos)) & (i->buffer_slots - 1)];
+}
+
+static int mpc_input_buffer_fill(mpc_input_t *i) {
+  
+  int c;
+  long k, n;
+  char *buffer;
+  
+  if (mpc_input_buffer_in_range(i)) { return 1; }
+  
+  c = getc(i->file);
+  if (c == EOF) { return 0; }
+  
+  /* Double the ring, unwrapping it into the new space */
+  if (i->buffer_num == i->buffer_slots) {
+    n = i->buffer_slots ? i->buffer_slots * 2 : 4096;
+    buffer = malloc(n);
+    /* The first ring is allocated here, so there is nothing to unwrap */
+    if (i->buffer) {
+      k = i->buffer_slots - i->buffer_head;
+      if (k > i->buffer_num) { k = i->buffer_num; }
+      memcpy(buffer, i->buffer + i->buffer_head, k);
+      memcpy(buffer + k, i->buffer, i->buffer_num - k);
+      free(i->buffer);
+    }
+    i->buffer = buffer;
+    i->buffer_head = 0;
+    i->buffer_slots = n;
+  }
+  
+  i->buffer[(i->buffer_head + i->buffer_num) & (i->buffer_slots - 1)] = (char)c;
+  i->buffer_num++;
+  return 1;
+}
+
+/* Drop what is before the cursor, which can't be read again */
+static void mpc_input_buffer_release(mpc_input_t *i) {
+  long n = i->state.pos - i->buffer_pos;
+  if (n > i->buffer_num) { n = i->buffer_num; }
+  if (n <= 0) { return; }
+  i->buffer_head = (i->buffer_head + n) & (i->buffer_slots - 1);
+  i->buffer_num -= n;
+  i->buffer_pos += n;
+}
+
 static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
   
   i->marks_num++;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
+  if (i->marks_num > i->marks_slots) {
+    i->marks_slots = i->marks_num * 2;
+    i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_slots);
+    i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
+  }
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-  
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
@@ -440,12 +875,9 @@ static void mpc_input_unmark(mpc_input_t *i) {
   if (i->backtrack < 1) { return; }
   
   i->marks_num--;
-  i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
-  i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
+    mpc_input_buffer_release(i);
   }
   
 }
@@ -464,18 +896,10 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
-
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos >= i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && !mpc_input_buffer_in_range(i) && feof(i->file)) { return 1; }
   return 0;
 }
 
@@ -485,20 +909,9 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-    
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
-    
+    case MPC_INPUT_PIPE: return mpc_input_buffer_fill(i) ? mpc_input_buffer_get(i) : (char)EOF;
     default: return c;
   }
 }
@@ -508,7 +921,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -517,24 +930,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
       fseek(i->file, -1, SEEK_CUR);
       return c;
     
-    case MPC_INPUT_PIPE:
-      
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-    
+    case MPC_INPUT_PIPE: return mpc_input_buffer_fill(i) ? mpc_input_buffer_get(i) : '\0';
     default: return c;
   }
   
@@ -545,16 +941,6 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-      
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file); 
-      }
-    }
     default: { break; }
   }
   return 0;
@@ -562,19 +948,14 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
-  if (i->type == MPC_INPUT_PIPE &&
-      i->buffer &&
-      !mpc_input_buffer_in_range(i)) {
-    
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-  
   i->last = c;
   i->state.pos++;
   i->state.col++;
   
+  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
+    mpc_input_buffer_release(i);
+  }
+  
   if (c == '\n') {
     i->state.col = 0;
     i->state.row++;
@@ -610,13 +991,13 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
 static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return x != '\0' && strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
 static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return x == '\0' || strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -625,6 +1006,53 @@ static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
   return cond(x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
+#define MPC_SET_HAS(s, c) ((s)[(unsigned char)(c) / 8] & (1 << ((unsigned char)(c) % 8)))
+#define MPC_SET_ADD(s, c) ((s)[(unsigned char)(c) / 8] |= (1 << ((unsigned char)(c) % 8)))
+
+static int mpc_input_class(mpc_input_t *i, const unsigned char *set, char **o) {
+  char x = mpc_input_getc(i);
+  if (mpc_input_terminated(i)) { return 0; }
+  return MPC_SET_HAS(set, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+}
+
+/*
+** Reads characters in `set` for as long as there
+** are any, which strings can do without copying
+** each one out.
+*/
+
+static char *mpc_input_scan(mpc_input_t *i, const unsigned char *set) {
+  
+  long n = 0, slots = 16, from = i->state.pos;
+  char x, *o;
+  
+  if (i->type == MPC_INPUT_STRING) {
+    while (i->state.pos < i->length && MPC_SET_HAS(set, i->string[i->state.pos])) {
+      mpc_input_success(i, i->string[i->state.pos], NULL);
+    }
+    n = i->state.pos - from;
+    o = malloc(n + 1);
+    memcpy(o, i->string + from, n);
+    o[n] = '\0';
+    return o;
+  }
+  
+  o = malloc(slots);
+  while (1) {
+    x = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    if (!MPC_SET_HAS(set, x)) { mpc_input_failure(i, x); break; }
+    mpc_input_success(i, x, NULL);
+    if (n + 1 == slots) {
+      slots *= 2;
+      o = realloc(o, slots);
+    }
+    o[n++] = x;
+  }
+  o[n] = '\0';
+  return o;
+}
+
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
   char *co = NULL;
@@ -651,6 +1079,139 @@ static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char)) {
   return f(i->last, mpc_input_peekc(i));
 }
 
+/*
+** Regex DFAs
+**
+** Regexes which can be matched deterministically
+** are compiled to a table driven DFA, see `mpc_re`.
+** Input bytes are mapped to equivalence classes and
+** the transition table is indexed by state and class.
+*/
+
+typedef struct {
+  int states_num;
+  int classes_num;
+  unsigned char classes[256];
+  short *trans;
+  char *accept;
+} mpc_dfa_t;
+
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  free(d->trans);
+  free(d->accept);
+  free(d);
+}
+
+/*
+** Length of the longest accepted prefix of the `len`
+** bytes at `s` or -1. Where the scan stopped is
+** stored in `end`.
+*/
+
+static long mpc_dfa_match(mpc_dfa_t *d, const char *s, long len, long *end) {
+  
+  int st = 0;
+  long n = 0;
+  long best = d->accept[0] ? 0 : -1;
+  
+  while (n < len) {
+    st = d->trans[st * d->classes_num + d->classes[(unsigned char)s[n]]];
+    if (st < 0) { break; }
+    n++;
+    if (d->accept[st]) { best = n; }
+  }
+  
+  *end = n;
+  return best;
+}
+
+/*
+** Returns 1 on a match, 0 when there is none and -1
+** when the DFA can't decide: backtracking is disabled
+** so the input can't be scanned ahead, or there is a
+** NUL byte in the input, which the parser can match
+** but the DFA never does.
+*/
+
+static int mpc_input_dfa(mpc_input_t *i, mpc_dfa_t *d, char **o) {
+  
+  int st = 0;
+  long n = 0, k;
+  long best = d->accept[0] ? 0 : -1;
+  char c;
+  
+  /* Strings are scanned in place */
+  if (i->type == MPC_INPUT_STRING) {
+    best = mpc_dfa_match(d, i->string + i->state.pos, i->length - i->state.pos, &n);
+    if (i->state.pos + n < i->length && i->string[i->state.pos + n] == '\0') { return -1; }
+    if (best < 0) { return 0; }
+    if (o) {
+      *o = malloc(best + 1);
+      memcpy(*o, i->string + i->state.pos, best);
+      (*o)[best] = '\0';
+    }
+    for (k = 0; k < best; k++) { mpc_input_success(i, i->string[i->state.pos], NULL); }
+    return 1;
+  }
+  
+  /* Otherwise read ahead, then rewind and consume the match */
+  if (i->backtrack < 1) { return -1; }
+  
+  mpc_input_mark(i);
+  while (1) {
+    c = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    if (c == '\0') { mpc_input_failure(i, c); mpc_input_rewind(i); return -1; }
+    st = d->trans[st * d->classes_num + d->classes[(unsigned char)c]];
+    if (st < 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    n++;
+    if (d->accept[st]) { best = n; }
+  }
+  mpc_input_rewind(i);
+  
+  if (best < 0) { return 0; }
+  
+  if (o) { *o = malloc(best + 1); }
+  for (k = 0; k < best; k++) {
+    c = mpc_input_getc(i);
+    mpc_input_success(i, c, NULL);
+    if (o) { (*o)[k] = c; }
+  }
+  if (o) { (*o)[best] = '\0'; }
+  return 1;
+}
+
+/*
+** Spans
+*/
+
+static void mpc_input_span_push(mpc_input_t *i, mpc_state_t s) {
+  if (i->spans_num == i->spans_slots) {
+    i->spans_slots = i->spans_slots ? i->spans_slots * 2 : 8;
+    i->spans = realloc(i->spans, sizeof(mpc_state_t) * i->spans_slots);
+  }
+  i->spans[i->spans_num++] = s;
+}
+
+static mpc_state_t mpc_input_span_pop(mpc_input_t *i) {
+  return i->spans[--i->spans_num];
+}
+
+static mpc_span_t *mpc_input_span(mpc_input_t *i, mpc_state_t from, char *copy) {
+  mpc_span_t *s = malloc(sizeof(mpc_span_t));
+  s->state = from;
+  s->copy = copy;
+  if (copy) {
+    s->data = copy;
+    s->length = strlen(copy);
+  } else {
+    s->data = i->string + from.pos;
+    s->length = i->state.pos - from.pos;
+  }
+  return s;
+}
+
 /*
 ** Parser Type
 */
@@ -683,7 +1244,14 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_DFA       = 25,
+  MPC_TYPE_MEMO      = 26,
+  MPC_TYPE_SPAN      = 27,
+  
+  MPC_TYPE_CLASS     = 28,
+  MPC_TYPE_SCAN      = 29
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -699,8 +1267,13 @@ typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_t
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct mpc_dispatch_t mpc_dispatch_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_dispatch_t *dispatch; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_copy_t c; mpc_dtor_t d; } mpc_pdata_memo_t;
+typedef struct { mpc_parser_t *x; } mpc_pdata_span_t;
+typedef struct { unsigned char *set; int min; int n; char **ms; unsigned char *sets; int split; } mpc_pdata_class_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -718,6 +1291,10 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_span_t span;
+  mpc_pdata_class_t cls;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -727,6 +1304,87 @@ struct mpc_parser_t {
   mpc_pdata_t data;
 };
 
+/*
+** Packrat lookups for `mpc_memo`. A hit moves the
+** input to where the stored result ended. A miss
+** saves the start so the result can be stored once
+** the parser returns. Pipes can't jump ahead and
+** are never memoized.
+*/
+
+/*
+** mpc's own AST folds and copies build their
+** nodes in the arena of the input, when it has
+** one, which callbacks can't be told about
+*/
+
+static mpc_val_t *mpc_ast_fold(mpc_ast_arena_t *r, int n, mpc_val_t **xs);
+static mpc_val_t *mpc_ast_str(mpc_ast_arena_t *r, mpc_val_t *c);
+static mpc_ast_t *mpc_ast_copy_to(mpc_ast_arena_t *r, mpc_ast_t *a);
+
+static mpc_val_t *mpc_input_memo_copy(mpc_input_t *i, mpc_parser_t *p, mpc_val_t *x) {
+  if (p->data.memo.c == (mpc_copy_t)mpc_ast_copy) { return mpc_ast_copy_to(i->arena, x); }
+  return p->data.memo.c(x);
+}
+
+static int mpc_input_memo_get(mpc_input_t *i, mpc_parser_t *p, mpc_lresult_t *r) {
+  
+  mpc_memo_entry_t k, *e;
+  mpc_memo_t *m;
+  
+  if (i->type == MPC_INPUT_PIPE) { return -1; }
+  if (!i->memo) { i->memo = mpc_memo_new(); }
+  m = i->memo;
+  
+  k.p = p;
+  k.start = i->state;
+  k.last = i->last;
+  k.backtrack = i->backtrack > 0;
+  
+  e = mpc_memo_find(m, &k);
+  if (e) {
+    i->state = e->end;
+    i->last = e->end_last;
+    if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+    if (e->success) {
+      r->output = mpc_input_memo_copy(i, p, e->r.output);
+      return 1;
+    } else {
+      r->error = mpc_lerr_copy(e->r.error);
+      return 0;
+    }
+  }
+  
+  if (m->starts_num == m->starts_slots) {
+    m->starts_slots = m->starts_slots ? m->starts_slots * 2 : 16;
+    m->starts = realloc(m->starts, sizeof(mpc_memo_entry_t) * m->starts_slots);
+  }
+  m->starts[m->starts_num++] = k;
+  return -1;
+}
+
+static void mpc_input_memo_put(mpc_input_t *i, mpc_parser_t *p, int success, mpc_lresult_t r) {
+  
+  mpc_memo_entry_t k;
+  
+  if (i->type == MPC_INPUT_PIPE) { return; }
+  k = i->memo->starts[--i->memo->starts_num];
+  
+  /* Without a copy function only failures are kept */
+  if (success && !p->data.memo.c) { return; }
+  
+  k.success = success;
+  k.end = i->state;
+  k.end_last = i->last;
+  k.d = p->data.memo.d;
+  if (success) {
+    k.r.output = mpc_input_memo_copy(i, p, r.output);
+  } else {
+    k.r.error = mpc_lerr_copy(r.error);
+  }
+  mpc_memo_insert(i->memo, &k);
+}
+
 /*
 ** Stack Type
 */
@@ -740,10 +1398,11 @@ typedef struct {
 
   int results_num;
   int results_slots;
-  mpc_result_t *results;
+  mpc_lresult_t *results;
   int *returns;
   
-  mpc_err_t *err;
+  mpc_lerr_t *err;
+  const char *filename;
   
 } mpc_stack_t;
 
@@ -760,16 +1419,25 @@ static mpc_stack_t *mpc_stack_new(const char *filename) {
   s->results = NULL;
   s->returns = NULL;
   
-  s->err = mpc_err_fail(filename, mpc_state_invalid(), "Unknown Error");
+  s->err = mpc_lerr_fail(mpc_state_invalid(), "Unknown Error");
+  s->filename = filename;
   
   return s;
 }
 
-static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
-  mpc_err_t *errs[2];
+static void mpc_stack_err(mpc_stack_t *s, mpc_lerr_t* e) {
+  mpc_lerr_t *errs[2];
   errs[0] = s->err;
   errs[1] = e;
-  s->err = mpc_err_or(errs, 2);
+  s->err = mpc_lerr_or(errs, 2);
+}
+
+static void mpc_stack_delete(mpc_stack_t *s) {
+  free(s->parsers);
+  free(s->states);
+  free(s->results);
+  free(s->returns);
+  free(s);
 }
 
 static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
@@ -777,17 +1445,12 @@ static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
   
   if (success) {
     r->output = s->results[0].output;
-    mpc_err_delete(s->err);
   } else {
     mpc_stack_err(s, s->results[0].error);
-    r->error = s->err;
+    r->error = mpc_lerr_err(s->err, s->err->state, s->filename);
   }
-  
-  free(s->parsers);
-  free(s->states);
-  free(s->results);
-  free(s->returns);
-  free(s);
+  mpc_lerr_delete(s->err);
+  mpc_stack_delete(s);
   
   return success;
 }
@@ -839,14 +1502,14 @@ static int mpc_stack_empty(mpc_stack_t *s) {
 
 /* Stack Result Stuff */
 
-static mpc_result_t mpc_result_err(mpc_err_t *e) {
-  mpc_result_t r;
+static mpc_lresult_t mpc_result_err(mpc_lerr_t *e) {
+  mpc_lresult_t r;
   r.error = e;
   return r;
 }
 
-static mpc_result_t mpc_result_out(mpc_val_t *x) {
-  mpc_result_t r;
+static mpc_lresult_t mpc_result_out(mpc_val_t *x) {
+  mpc_lresult_t r;
   r.output = x;
   return r;
 }
@@ -854,7 +1517,7 @@ static mpc_result_t mpc_result_out(mpc_val_t *x) {
 static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
   if (s->results_num > s->results_slots) {
     s->results_slots = ceil((s->results_slots + 1) * 1.5);
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->results = realloc(s->results, sizeof(mpc_lresult_t) * s->results_slots);
     s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
@@ -862,19 +1525,19 @@ static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
 static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
   if ( s->results_slots > pow(s->results_num+1, 1.5)) {
     s->results_slots = floor((s->results_slots-1) * (1.0/1.5));
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->results = realloc(s->results, sizeof(mpc_lresult_t) * s->results_slots);
     s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
 
-static void mpc_stack_pushr(mpc_stack_t *s, mpc_result_t x, int r) {
+static void mpc_stack_pushr(mpc_stack_t *s, mpc_lresult_t x, int r) {
   s->results_num++;
   mpc_stack_results_reserve_more(s);
   s->results[s->results_num-1] = x;
   s->returns[s->results_num-1] = r;
 }
 
-static int mpc_stack_popr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_popr(mpc_stack_t *s, mpc_lresult_t *x) {
   int r;
   *x = s->results[s->results_num-1];
   r = s->returns[s->results_num-1];
@@ -883,22 +1546,36 @@ static int mpc_stack_popr(mpc_stack_t *s, mpc_result_t *x) {
   return r;
 }
 
-static int mpc_stack_peekr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_peekr(mpc_stack_t *s, mpc_lresult_t *x) {
   *x = s->results[s->results_num-1];
   return s->returns[s->results_num-1];
 }
 
+/*
+** The error of a split class stands for several
+** alternatives, which are stashed one by one in the
+** order they would have been had each been tried,
+** and moved to where it is as `mpc_lerr_at` keeps
+** only the state at the top.
+*/
+
 static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
-  mpc_result_t x;
+  int i;
+  mpc_lresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
-    mpc_stack_err(s, x.error);
+    if (x.error->type == MPC_LERR_SPLIT) {
+      for (i = x.error->xs_num-1; i >= 0; i--) { mpc_stack_err(s, mpc_lerr_at(x.error->xs[i], x.error->state)); }
+      mpc_lerr_delete(x.error);
+    } else {
+      mpc_stack_err(s, x.error);
+    }
     n--;
   }
 }
 
 static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
-  mpc_result_t x;
+  mpc_lresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     ds[n-1](x.output);
@@ -907,7 +1584,7 @@ static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
 }
 
 static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
-  mpc_result_t x;
+  mpc_lresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     dx(x.output);
@@ -916,25 +1593,320 @@ static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
 }
 
 static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
-  mpc_result_t x;
+  mpc_lresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     n--;
   }
 }
 
-static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
-  mpc_val_t *x = f(n, (mpc_val_t**)(&s->results[s->results_num-n]));
+static mpc_val_t *mpc_stack_merger_out(mpc_input_t *i, mpc_stack_t *s, int n, mpc_fold_t f) {
+  mpc_val_t **xs = (mpc_val_t**)(&s->results[s->results_num-n]);
+  mpc_val_t *x = f == mpcf_fold_ast ? mpc_ast_fold(i->arena, n, xs) : f(n, xs);
   mpc_stack_popr_n(s, n);
   return x;
 }
 
-static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
-  mpc_err_t *x = mpc_err_or((mpc_err_t**)(&s->results[s->results_num-n]), n);
+static mpc_lerr_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
+  mpc_lerr_t *y, *x = mpc_lerr_or((mpc_lerr_t**)(&s->results[s->results_num-n]), n);
   mpc_stack_popr_n(s, n);
+  if (x->type == MPC_LERR_SPLIT) {
+    y = mpc_lerr_at(x, x->state);
+    y->type = MPC_LERR_OR;
+    mpc_lerr_delete(x);
+    return y;
+  }
   return x;
 }
 
+/*
+** First Sets
+**
+** Most alternatives of an `or` can be ruled out by
+** looking at the next character. Each `or` keeps a
+** table of which of its alternatives can start with
+** each character, built the first time it is run
+** and rebuilt after any parser is (re)defined, as
+** that can change what its alternatives start with.
+**
+** Alternatives that can match nothing are possible
+** after any character. The others are skipped when
+** they can't start with it, but still give the same
+** errors as if they had been tried, see below.
+*/
+
+enum {
+  MPC_FIRST_DEPTH = 64,
+  MPC_FIRST_ALTS  = 32
+};
+
+struct mpc_dispatch_t {
+  int generation;
+  int nullable;
+  unsigned char first[32];
+  unsigned long alts[256];
+  mpc_lerr_t **skipped[256];
+};
+
+static int mpc_first_generation = 0;
+
+static int mpc_re_class(mpc_parser_t *p, unsigned char *set);
+static void mpc_or_dispatch(mpc_parser_t *p, mpc_parser_t **seen, int depth);
+
+/*
+** Adds the characters `p` can start with to `first`
+** and returns if `p` can match without consuming
+** any. Anything not known is assumed to start with
+** any character and to maybe match nothing.
+*/
+
+static int mpc_first(mpc_parser_t *p, unsigned char *first, mpc_parser_t **seen, int depth) {
+  
+  int i, c, nullable;
+  mpc_dfa_t *d;
+  
+  for (i = 0; i < depth; i++) { if (seen[i] == p) { break; } }
+  if (i < depth || depth == MPC_FIRST_DEPTH) {
+    memset(first, 0xFF, 32);
+    return 1;
+  }
+  seen[depth++] = p;
+  
+  if (mpc_re_class(p, first)) { return 0; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_FAIL: return 0;
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+      return 1;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      MPC_SET_ADD(first, p->data.string.x[0]);
+      return 0;
+    
+    case MPC_TYPE_EXPECT:   return mpc_first(p->data.expect.x, first, seen, depth);
+    case MPC_TYPE_APPLY:    return mpc_first(p->data.apply.x, first, seen, depth);
+    case MPC_TYPE_APPLY_TO: return mpc_first(p->data.apply_to.x, first, seen, depth);
+    case MPC_TYPE_PREDICT:  return mpc_first(p->data.predict.x, first, seen, depth);
+    case MPC_TYPE_MEMO:     return mpc_first(p->data.memo.x, first, seen, depth);
+    case MPC_TYPE_SPAN:     return mpc_first(p->data.span.x, first, seen, depth);
+    
+    /* These look past the next character without consuming it */
+    case MPC_TYPE_ANCHOR: memset(first, 0xFF, 32); return 1;
+    case MPC_TYPE_NOT:   mpc_first(p->data.not.x, first, seen, depth); return 1;
+    
+    case MPC_TYPE_MAYBE: mpc_first(p->data.not.x, first, seen, depth); return 1;
+    case MPC_TYPE_MANY:  mpc_first(p->data.repeat.x, first, seen, depth); return 1;
+    case MPC_TYPE_MANY1: return mpc_first(p->data.repeat.x, first, seen, depth);
+    case MPC_TYPE_COUNT: 
+      nullable = mpc_first(p->data.repeat.x, first, seen, depth);
+      return nullable || p->data.repeat.n == 0;
+    
+    case MPC_TYPE_CLASS:
+    case MPC_TYPE_SCAN:
+      for (i = 0; i < 32; i++) { first[i] |= p->data.cls.set[i]; }
+      return p->type == MPC_TYPE_SCAN && p->data.cls.min == 0;
+    
+    case MPC_TYPE_DFA:
+      d = p->data.dfa.d;
+      for (c = 1; c < 256; c++) {
+        if (d->trans[d->classes[c]] >= 0) { MPC_SET_ADD(first, c); }
+      }
+      return d->accept[0];
+    
+    case MPC_TYPE_OR:
+      mpc_or_dispatch(p, seen, depth);
+      for (i = 0; i < 32; i++) { first[i] |= p->data.or.dispatch->first[i]; }
+      return p->data.or.dispatch->nullable;
+    
+    case MPC_TYPE_AND:
+      nullable = 1;
+      for (i = 0; i < p->data.and.n && nullable; i++) {
+        nullable = mpc_first(p->data.and.xs[i], first, seen, depth);
+      }
+      return nullable;
+    
+    default:
+      memset(first, 0xFF, 32);
+      return 1;
+  }
+  
+}
+
+static void mpc_dispatch_clear(mpc_dispatch_t *t) {
+  int c, j;
+  for (c = 0; c < 256; c++) {
+    if (!t->skipped[c]) { continue; }
+    for (j = 0; j < MPC_FIRST_ALTS * 2; j++) {
+      if (t->skipped[c][j]) { mpc_lerr_delete(t->skipped[c][j]); }
+    }
+    free(t->skipped[c]);
+    t->skipped[c] = NULL;
+  }
+}
+
+static void mpc_dispatch_delete(mpc_parser_t *p) {
+  if (!p->data.or.dispatch) { return; }
+  mpc_dispatch_clear(p->data.or.dispatch);
+  free(p->data.or.dispatch);
+  p->data.or.dispatch = NULL;
+}
+
+static void mpc_or_dispatch(mpc_parser_t *p, mpc_parser_t **seen, int depth) {
+  
+  int i, c, nullable;
+  unsigned char set[32];
+  mpc_dispatch_t *t = p->data.or.dispatch;
+  
+  if (t && t->generation == mpc_first_generation) { return; }
+  if (!t) { t = p->data.or.dispatch = calloc(1, sizeof(mpc_dispatch_t)); }
+  
+  mpc_dispatch_clear(t);
+  t->generation = mpc_first_generation;
+  t->nullable = 0;
+  memset(t->first, 0, 32);
+  memset(t->alts, 0, sizeof(t->alts));
+  
+  for (i = 0; i < p->data.or.n; i++) {
+    memset(set, 0, 32);
+    nullable = mpc_first(p->data.or.xs[i], set, seen, depth);
+    for (c = 0; c < 32; c++) { t->first[c] |= set[c]; }
+    t->nullable = t->nullable || nullable;
+    for (c = 0; c < 256; c++) {
+      if (i >= MPC_FIRST_ALTS) { t->alts[c] = ~0UL; continue; }
+      if (nullable || MPC_SET_HAS(set, c)) { t->alts[c] |= 1UL << i; }
+    }
+  }
+  
+  /* The end of input, and NUL bytes, try everything */
+  t->alts[0] = ~0UL;
+  
+}
+
+static unsigned long mpc_or_alts(mpc_parser_t *p, char c) {
+  mpc_parser_t *seen[MPC_FIRST_DEPTH];
+  mpc_or_dispatch(p, seen, 0);
+  return p->data.or.dispatch->alts[(unsigned char)c];
+}
+
+/*
+** An alternative that can't start with the next
+** character fails there without consuming any input,
+** so what it reports depends on that character alone.
+** The first time it is skipped on a character it is
+** run to find what errors it would stash and fail
+** with, and after that these are moved to where it
+** is skipped, which keeps the errors exactly as if
+** every alternative had been tried.
+*/
+
+static void mpc_parse_run(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *init);
+
+static mpc_lerr_t **mpc_or_skipped(mpc_input_t *i, mpc_parser_t *p, char c) {
+  
+  int j;
+  mpc_lresult_t r;
+  mpc_stack_t *stk;
+  mpc_dispatch_t *t = p->data.or.dispatch;
+  mpc_lerr_t **xs = t->skipped[(unsigned char)c];
+  
+  if (xs) { return xs; }
+  xs = t->skipped[(unsigned char)c] = calloc(MPC_FIRST_ALTS * 2, sizeof(mpc_lerr_t*));
+  
+  for (j = 0; j < p->data.or.n && j < MPC_FIRST_ALTS; j++) {
+    if (t->alts[(unsigned char)c] & (1UL << j)) { continue; }
+    stk = mpc_stack_new(i->filename);
+    mpc_parse_run(i, stk, p->data.or.xs[j]);
+    mpc_stack_popr(stk, &r);
+    if (stk->err->state.pos >= 0) {
+      xs[j*2+0] = stk->err;
+    } else {
+      mpc_lerr_delete(stk->err);
+    }
+    xs[j*2+1] = r.error;
+    mpc_stack_delete(stk);
+  }
+  
+  return xs;
+}
+
+/*
+** Skips the alternatives from `j` on which can't
+** start with the next character, and returns the
+** next one to try.
+*/
+
+static int mpc_or_skip(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *p, int j) {
+  
+  char c = mpc_input_peekc(i);
+  unsigned long alts = mpc_or_alts(p, c);
+  mpc_lerr_t **xs;
+  
+  if (j >= p->data.or.n || j >= MPC_FIRST_ALTS || (alts & (1UL << j))) { return j; }
+  
+  xs = mpc_or_skipped(i, p, c);
+  while (j < p->data.or.n && j < MPC_FIRST_ALTS && !(alts & (1UL << j))) {
+    if (xs[j*2+0]) { mpc_stack_err(stk, mpc_lerr_at(xs[j*2+0], i->state)); }
+    mpc_stack_pushr(stk, mpc_result_err(mpc_lerr_at(xs[j*2+1], i->state)), 0);
+    j++;
+  }
+  
+  return j;
+}
+
+/*
+** A class fails as the `expect`s it was made from
+** would have, or as a bare character parser if it
+** wasn't made from any. A split class stands for
+** some alternatives of an `or`, see `mpc_optimise`,
+** so its error is split up again when stashed.
+*/
+
+static mpc_lerr_t *mpc_lerr_class(mpc_input_t *i, mpc_parser_t *p) {
+  
+  int k;
+  char c;
+  mpc_lerr_t *e;
+  
+  if (p->data.cls.n == 0) { return mpc_lerr_fail(i->state, "Incorrect Input"); }
+  
+  c = mpc_input_peekc(i);
+  if (p->data.cls.n == 1) { return mpc_lerr_new(i->state, p->data.cls.ms[0], c); }
+  
+  e = mpc_lerr_alloc(p->data.cls.split ? MPC_LERR_SPLIT : MPC_LERR_OR, i->state, NULL, c);
+  for (k = 0; k < p->data.cls.n; k++) {
+    mpc_lerr_add(e, mpc_lerr_new(i->state, p->data.cls.ms[k], c));
+  }
+  return e;
+}
+
+/*
+** When a class matches, the `expect`s before the
+** first one matching would have failed, and their
+** errors are stashed as the `or` would have done.
+*/
+
+static void mpc_stack_class_err(mpc_stack_t *s, mpc_input_t *i, mpc_parser_t *p) {
+  
+  int j, k;
+  char c;
+  
+  if (p->data.cls.n < 2) { return; }
+  
+  c = mpc_input_peekc(i);
+  for (k = 0; k < p->data.cls.n; k++) {
+    if (MPC_SET_HAS(p->data.cls.sets + k * 32, c)) { break; }
+  }
+  if (k == p->data.cls.n) { return; }
+  
+  for (j = k-1; j >= 0; j--) { mpc_stack_err(s, mpc_lerr_new(i->state, p->data.cls.ms[j], c)); }
+}
+
 /*
 ** This is rather pleasant. The core parsing routine
 ** is written in about 200 lines of C.
@@ -959,18 +1931,19 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
 #define MPC_CONTINUE(st, x) mpc_stack_set_state(stk, st); mpc_stack_pushp(stk, x); continue
 #define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); continue
 #define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
-#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_PRIMATIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_lerr_fail(i->state, "Incorrect Input")); }
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+static void mpc_parse_run(mpc_input_t *i, mpc_stack_t *stk, mpc_parser_t *init) {
   
   /* Stack */
   int st = 0;
   mpc_parser_t *p = NULL;
-  mpc_stack_t *stk = mpc_stack_new(i->filename);
   
   /* Variables */
   char *s;
-  mpc_result_t r;
+  int memo;
+  mpc_state_t from;
+  mpc_lresult_t r;
 
   /* Go! */
   mpc_stack_pushp(stk, init);
@@ -993,9 +1966,9 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       
       /* Other parsers */
       
-      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
+      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_lerr_fail(i->state, "Parser Undefined!"));      
       case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
+      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_lerr_fail(i->state, p->data.fail.m));
       case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
       case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
       case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_state_copy(i->state));
@@ -1004,7 +1977,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (mpc_input_anchor(i, p->data.anchor.f)) {
           MPC_SUCCESS(NULL);
         } else {
-          MPC_FAILURE(mpc_err_new(i->filename, i->state, "anchor", mpc_input_peekc(i)));
+          MPC_FAILURE(mpc_lerr_new(i->state, "anchor", mpc_input_peekc(i)));
         }
       
       /* Application Parsers */
@@ -1015,8 +1988,8 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             MPC_SUCCESS(r.output);
           } else {
-            mpc_err_delete(r.error); 
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, p->data.expect.m, mpc_input_peekc(i)));
+            mpc_lerr_delete(r.error); 
+            MPC_FAILURE(mpc_lerr_new(i->state, p->data.expect.m, mpc_input_peekc(i)));
           }
         }
       
@@ -1024,6 +1997,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (st == 0) { MPC_CONTINUE(1, p->data.apply.x); }
         if (st == 1) {
           if (mpc_stack_popr(stk, &r)) {
+            if (p->data.apply.f == mpcf_str_ast) { MPC_SUCCESS(mpc_ast_str(i->arena, r.output)); }
             MPC_SUCCESS(p->data.apply.f(r.output));
           } else {
             MPC_FAILURE(r.error);
@@ -1058,7 +2032,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             mpc_input_rewind(i);
             p->data.not.dx(r.output);
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite", mpc_input_peekc(i)));
+            MPC_FAILURE(mpc_lerr_new(i->state, "opposite", mpc_input_peekc(i)));
           } else {
             mpc_input_unmark(i);
             mpc_stack_err(stk, r.error);
@@ -1087,7 +2061,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             mpc_stack_popr(stk, &r);
             mpc_stack_err(stk, r.error);
-            MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+            MPC_SUCCESS(mpc_stack_merger_out(i, stk, st-1, p->data.repeat.f));
           }
         }
       
@@ -1099,11 +2073,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             if (st == 1) {
               mpc_stack_popr(stk, &r);
-              MPC_FAILURE(mpc_err_many1(r.error));
+              MPC_FAILURE(mpc_lerr_repeat(r.error, MPC_LERR_MANY1, 0));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(i, stk, st-1, p->data.repeat.f));
             }
           }
         }
@@ -1118,12 +2092,12 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
               mpc_stack_popr(stk, &r);
               mpc_stack_popr_out_single(stk, st-1, p->data.repeat.dx);
               mpc_input_rewind(i);
-              MPC_FAILURE(mpc_err_count(r.error, p->data.repeat.n));
+              MPC_FAILURE(mpc_lerr_repeat(r.error, MPC_LERR_COUNT, p->data.repeat.n));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
               mpc_input_unmark(i);
-              MPC_SUCCESS(mpc_stack_merger_out(stk, st-1, p->data.repeat.f));
+              MPC_SUCCESS(mpc_stack_merger_out(i, stk, st-1, p->data.repeat.f));
             }
           }
         }
@@ -1134,16 +2108,15 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         
         if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
         
-        if (st == 0) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
-        if (st <= p->data.or.n) {
-          if (mpc_stack_peekr(stk, &r)) {
-            mpc_stack_popr(stk, &r);
-            mpc_stack_popr_err(stk, st-1);
-            MPC_SUCCESS(r.output);
-          }
-          if (st <  p->data.or.n) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
-          if (st == p->data.or.n) { MPC_FAILURE(mpc_stack_merger_err(stk, p->data.or.n)); }
+        if (st > 0 && mpc_stack_peekr(stk, &r)) {
+          mpc_stack_popr(stk, &r);
+          mpc_stack_popr_err(stk, st-1);
+          MPC_SUCCESS(r.output);
         }
+        
+        st = mpc_or_skip(i, stk, p, st);
+        if (st < p->data.or.n) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
+        MPC_FAILURE(mpc_stack_merger_err(stk, p->data.or.n));
       
       case MPC_TYPE_AND:
         
@@ -1158,19 +2131,87 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
             MPC_FAILURE(r.error);
           }
           if (st <  p->data.and.n) { MPC_CONTINUE(st+1, p->data.and.xs[st]); }
-          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
+          if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(i, stk, p->data.and.n, p->data.and.f)); }
+        }
+      
+      /* Packrat Memoization */
+      
+      case MPC_TYPE_MEMO:
+        if (st == 0) {
+          memo = mpc_input_memo_get(i, p, &r);
+          if (memo == 1) { MPC_SUCCESS(r.output); }
+          if (memo == 0) { MPC_FAILURE(r.error); }
+          MPC_CONTINUE(1, p->data.memo.x);
+        }
+        if (mpc_stack_popr(stk, &r)) {
+          mpc_input_memo_put(i, p, 1, r);
+          MPC_SUCCESS(r.output);
+        } else {
+          mpc_input_memo_put(i, p, 0, r);
+          MPC_FAILURE(r.error);
+        }
+      
+      /* Spans, pointing into string input rather than copying out of it */
+      
+      case MPC_TYPE_SPAN:
+        if (st == 0) {
+          from = i->state;
+          if (i->type == MPC_INPUT_STRING
+          &&  p->data.span.x->type == MPC_TYPE_DFA
+          &&  mpc_input_dfa(i, p->data.span.x->data.dfa.d, NULL) == 1) {
+            MPC_SUCCESS(mpc_input_span(i, from, NULL));
+          }
+          mpc_input_span_push(i, from);
+          MPC_CONTINUE(1, p->data.span.x);
+        }
+        from = mpc_input_span_pop(i);
+        if (mpc_stack_popr(stk, &r)) {
+          if (i->type == MPC_INPUT_STRING) {
+            free(r.output);
+            MPC_SUCCESS(mpc_input_span(i, from, NULL));
+          }
+          MPC_SUCCESS(mpc_input_span(i, from, r.output));
+        } else {
+          MPC_FAILURE(r.error);
+        }
+      
+      /* Character classes, see `mpc_optimise` */
+      
+      case MPC_TYPE_CLASS:
+        mpc_stack_class_err(stk, i, p);
+        if (mpc_input_class(i, p->data.cls.set, &s)) { MPC_SUCCESS(s); }
+        MPC_FAILURE(mpc_lerr_class(i, p));
+      
+      case MPC_TYPE_SCAN:
+        s = mpc_input_scan(i, p->data.cls.set);
+        if (s[0] == '\0' && p->data.cls.min) {
+          free(s);
+          MPC_FAILURE(mpc_lerr_repeat(mpc_lerr_class(i, p), MPC_LERR_MANY1, 0));
+        }
+        mpc_stack_err(stk, mpc_lerr_class(i, p));
+        MPC_SUCCESS(s);
+      
+      /* Compiled Regex, falling back to the parser for errors */
+      
+      case MPC_TYPE_DFA:
+        if (st == 0) {
+          if (mpc_input_dfa(i, p->data.dfa.d, &s) == 1) { MPC_SUCCESS(s); }
+          MPC_CONTINUE(1, p->data.dfa.x);
+        }
+        if (mpc_stack_popr(stk, &r)) {
+          MPC_SUCCESS(r.output);
+        } else {
+          MPC_FAILURE(r.error);
         }
       
       /* End */
       
       default:
         
-        MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Unknown Parser Type Id!"));
+        MPC_FAILURE(mpc_lerr_fail(i->state, "Unknown Parser Type Id!"));
     }
   }
   
-  return mpc_stack_terminate(stk, final);
-  
 }
 
 #undef MPC_CONTINUE
@@ -1178,9 +2219,24 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
 #undef MPC_FAILURE
 #undef MPC_PRIMATIVE
 
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
+  mpc_stack_t *stk = mpc_stack_new(i->filename);
+  mpc_parse_run(i, stk, init);
+  return mpc_stack_terminate(stk, final);
+}
+
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_buffer(filename, string, strlen(string), p, r);
+}
+
+int mpc_parse_buffer(const char *filename, const char *buffer, long length, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_arena(filename, buffer, length, p, r, NULL);
+}
+
+int mpc_parse_arena(const char *filename, const char *buffer, long length, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a) {
   int x;
-  mpc_input_t *i = mpc_input_new_string(filename, string);
+  mpc_input_t *i = mpc_input_new_string(filename, buffer, length);
+  i->arena = a;
   x = mpc_parse_input(i, p, r);
   mpc_input_delete(i);
   return x;
@@ -1231,6 +2287,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  mpc_dispatch_delete(p);
   
 }
 
@@ -1247,6 +2304,8 @@ static void mpc_undefine_and(mpc_parser_t *p) {
 
 static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
+  int i;
+  
   if (p->retained && !force) { return; }
   
   switch (p->type) {
@@ -1282,6 +2341,22 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
     
+    case MPC_TYPE_DFA:
+      mpc_dfa_delete(p->data.dfa.d);
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      break;
+    
+    case MPC_TYPE_MEMO: mpc_undefine_unretained(p->data.memo.x, 0); break;
+    case MPC_TYPE_SPAN: mpc_undefine_unretained(p->data.span.x, 0); break;
+    
+    case MPC_TYPE_CLASS:
+    case MPC_TYPE_SCAN:
+      for (i = 0; i < p->data.cls.n; i++) { free(p->data.cls.ms[i]); }
+      free(p->data.cls.ms);
+      free(p->data.cls.set);
+      free(p->data.cls.sets);
+      break;
+    
     default: break;
   }
   
@@ -1330,11 +2405,14 @@ mpc_parser_t *mpc_new(const char *name) {
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
+  mpc_first_generation++;
   return p;
 }
 
 mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   
+  mpc_first_generation++;
+  
   if (p->retained) {
     p->type = a->type;
     p->data = a->data;
@@ -1568,13 +2646,43 @@ mpc_parser_t *mpc_apply_to(mpc_parser_t *a, mpc_apply_to_t f, void *x) {
   return p;
 }
 
-mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
+mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PREDICT;
+  p->data.predict.x = a;
+  return p;
+}
+
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_copy_t c, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.c = c;
+  p->data.memo.d = da;
+  return p;
+}
+
+/*
+** The span of input `a` consumed. On string input
+** this points into the caller's buffer, which must
+** outlive it, and `a`'s output is discarded. Other
+** input can't be pointed into, so there `a` must
+** output the text it consumed, which the span keeps.
+*/
+
+mpc_parser_t *mpc_span(mpc_parser_t *a) {
   mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_PREDICT;
-  p->data.predict.x = a;
+  p->type = MPC_TYPE_SPAN;
+  p->data.span.x = a;
   return p;
 }
 
+void mpc_span_delete(mpc_val_t *x) {
+  mpc_span_t *s = x;
+  free(s->copy);
+  free(s);
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -2005,6 +3113,411 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** Regex DFA Compilation
+**
+** The parser built above is compiled to a DFA via
+** a Thompson NFA and the subset construction. The
+** parser is used directly as the regex syntax tree,
+** so the DFA matches exactly the constructs the
+** regex grammar produced.
+**
+** Those parsers are greedy and never backtrack into
+** a repetition or alternative once it has matched,
+** while a DFA finds the longest match. The two only
+** agree when every choice is decided by the next
+** character, so the regex must pass an LL(1) check:
+** alternatives start with distinct characters, and
+** nothing optional or repeated can start with a
+** character that may follow it. Regexes which fail
+** the check, or use anchors, lookahead, counted
+** repeats (which here must match exactly `n` times)
+** or other features a DFA can't express, keep the
+** parser.
+*/
+
+enum {
+  MPC_DFA_MAX_STATES = 256,
+  MPC_NFA_MAX_STATES = 1024
+};
+
+typedef struct {
+  int num;
+  int slots;
+  int *next;
+  int *eps0;
+  int *eps1;
+  unsigned char *sets;
+} mpc_nfa_t;
+
+static int mpc_nfa_state(mpc_nfa_t *n) {
+  
+  if (n->num == MPC_NFA_MAX_STATES) { return -1; }
+  
+  if (n->num == n->slots) {
+    n->slots = n->slots ? n->slots * 2 : 16;
+    n->next = realloc(n->next, sizeof(int) * n->slots);
+    n->eps0 = realloc(n->eps0, sizeof(int) * n->slots);
+    n->eps1 = realloc(n->eps1, sizeof(int) * n->slots);
+    n->sets = realloc(n->sets, 32 * n->slots);
+  }
+  
+  n->next[n->num] = -1;
+  n->eps0[n->num] = -1;
+  n->eps1[n->num] = -1;
+  memset(n->sets + 32 * n->num, 0, 32);
+  return n->num++;
+}
+
+static void mpc_nfa_eps(mpc_nfa_t *n, int x, int y) {
+  if (n->eps0[x] < 0) { n->eps0[x] = y; } else { n->eps1[x] = y; }
+}
+
+/*
+** Parsers that match exactly one character. Adds
+** the characters they accept to `set` if given.
+*/
+
+static int mpc_re_class(mpc_parser_t *p, unsigned char *set) {
+  
+  int c;
+  char x;
+  
+  if (p->type != MPC_TYPE_SINGLE && p->type != MPC_TYPE_RANGE &&
+      p->type != MPC_TYPE_ONEOF && p->type != MPC_TYPE_NONEOF &&
+      p->type != MPC_TYPE_ANY) { return 0; }
+  
+  if (set == NULL) { return 1; }
+  
+  /* The terminating zero is never matched */
+  for (c = 1; c < 256; c++) {
+    x = (char)c;
+    if ((p->type == MPC_TYPE_SINGLE && x == p->data.single.x) ||
+        (p->type == MPC_TYPE_RANGE && x >= p->data.range.x && x <= p->data.range.y) ||
+        (p->type == MPC_TYPE_ONEOF && strchr(p->data.string.x, x) != 0) ||
+        (p->type == MPC_TYPE_NONEOF && strchr(p->data.string.x, x) == 0) ||
+        (p->type == MPC_TYPE_ANY)) {
+      MPC_SET_ADD(set, x);
+    }
+  }
+  
+  return 1;
+}
+
+/*
+** Adds the characters `p` can start with to `first`
+** and returns if `p` can match nothing, or -1 if `p`
+** isn't something a DFA can match.
+*/
+
+static int mpc_re_first(mpc_parser_t *p, unsigned char *first) {
+  
+  int i, j, r, nullable;
+  unsigned char set[32];
+  
+  if (p->retained) { return -1; }
+  if (mpc_re_class(p, first)) { return 0; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT: return mpc_re_first(p->data.expect.x, first);
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str ? 1 : -1;
+    
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return -1; }
+      return mpc_re_first(p->data.not.x, first) < 0 ? -1 : 1;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return -1; }
+      r = mpc_re_first(p->data.repeat.x, first);
+      if (r < 0) { return -1; }
+      return p->type == MPC_TYPE_MANY ? 1 : r;
+    
+    case MPC_TYPE_OR:
+      nullable = 0;
+      for (i = 0; i < p->data.or.n; i++) {
+        r = mpc_re_first(p->data.or.xs[i], first);
+        if (r < 0) { return -1; }
+        nullable = nullable || r;
+      }
+      return nullable;
+    
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return -1; }
+      nullable = 1;
+      for (i = 0; i < p->data.and.n; i++) {
+        memset(set, 0, 32);
+        r = mpc_re_first(p->data.and.xs[i], set);
+        if (r < 0) { return -1; }
+        if (nullable) { for (j = 0; j < 32; j++) { first[j] |= set[j]; } }
+        nullable = nullable && r;
+      }
+      return nullable;
+    
+    default: return -1;
+  }
+  
+}
+
+static int mpc_re_disjoint(const unsigned char *x, const unsigned char *y) {
+  int i;
+  for (i = 0; i < 32; i++) { if (x[i] & y[i]) { return 0; } }
+  return 1;
+}
+
+/*
+** Builds the NFA fragment for `p` from state `*s` to
+** state `*e`, given the characters that may `follow`
+** it. Returns 0 if `p` fails the LL(1) check.
+*/
+
+static int mpc_re_nfa(mpc_nfa_t *n, mpc_parser_t *p, const unsigned char *follow, int *s, int *e) {
+  
+  int i, j, k, r, cs, ce, next;
+  unsigned char first[32], set[32], f[32];
+  
+  memset(first, 0, 32);
+  r = mpc_re_first(p, first);
+  if (r < 0) { return 0; }
+  
+  /* A choice to match nothing must not compete with what follows */
+  if (r && !mpc_re_disjoint(first, follow)) { return 0; }
+  
+  if (mpc_re_class(p, NULL)) {
+    *s = mpc_nfa_state(n);
+    *e = mpc_nfa_state(n);
+    if (*s < 0 || *e < 0) { return 0; }
+    memcpy(n->sets + 32 * *s, first, 32);
+    n->next[*s] = *e;
+    return 1;
+  }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_EXPECT: return mpc_re_nfa(n, p->data.expect.x, follow, s, e);
+    
+    case MPC_TYPE_LIFT:
+      *s = *e = mpc_nfa_state(n);
+      return *s >= 0;
+    
+    case MPC_TYPE_MAYBE:
+      if (!mpc_re_nfa(n, p->data.not.x, follow, &cs, &ce)) { return 0; }
+      *s = mpc_nfa_state(n);
+      *e = mpc_nfa_state(n);
+      if (*s < 0 || *e < 0) { return 0; }
+      mpc_nfa_eps(n, *s, cs);
+      mpc_nfa_eps(n, *s, *e);
+      mpc_nfa_eps(n, ce, *e);
+      return 1;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      
+      /* The body can't match nothing, nor start like what follows the loop */
+      memset(set, 0, 32);
+      if (mpc_re_first(p->data.repeat.x, set)) { return 0; }
+      if (!mpc_re_disjoint(set, follow)) { return 0; }
+      for (i = 0; i < 32; i++) { f[i] = set[i] | follow[i]; }
+      
+      if (!mpc_re_nfa(n, p->data.repeat.x, f, &cs, &ce)) { return 0; }
+      *s = mpc_nfa_state(n);
+      *e = mpc_nfa_state(n);
+      if (*s < 0 || *e < 0) { return 0; }
+      mpc_nfa_eps(n, *s, cs);
+      if (p->type == MPC_TYPE_MANY) { mpc_nfa_eps(n, *s, *e); }
+      mpc_nfa_eps(n, ce, cs);
+      mpc_nfa_eps(n, ce, *e);
+      return 1;
+    
+    case MPC_TYPE_OR:
+      
+      /* Alternatives start differently and only the last can match nothing */
+      for (i = 0; i < p->data.or.n; i++) {
+        memset(set, 0, 32);
+        if (mpc_re_first(p->data.or.xs[i], set) && i != p->data.or.n-1) { return 0; }
+        for (j = i+1; j < p->data.or.n; j++) {
+          memset(f, 0, 32);
+          mpc_re_first(p->data.or.xs[j], f);
+          if (!mpc_re_disjoint(set, f)) { return 0; }
+        }
+      }
+      
+      /* Each split state branches to one alternative and the next split */
+      *s = k = mpc_nfa_state(n);
+      *e = mpc_nfa_state(n);
+      if (*s < 0 || *e < 0) { return 0; }
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_re_nfa(n, p->data.or.xs[i], follow, &cs, &ce)) { return 0; }
+        mpc_nfa_eps(n, k, cs);
+        mpc_nfa_eps(n, ce, *e);
+        if (i < p->data.or.n-1) {
+          next = mpc_nfa_state(n);
+          if (next < 0) { return 0; }
+          mpc_nfa_eps(n, k, next);
+          k = next;
+        }
+      }
+      return 1;
+    
+    case MPC_TYPE_AND:
+      
+      /* Built back to front, so each part knows what follows it */
+      memcpy(f, follow, 32);
+      *e = next = mpc_nfa_state(n);
+      if (next < 0) { return 0; }
+      
+      for (i = p->data.and.n-1; i >= 0; i--) {
+        if (!mpc_re_nfa(n, p->data.and.xs[i], f, &cs, &ce)) { return 0; }
+        mpc_nfa_eps(n, ce, next);
+        next = cs;
+        memset(set, 0, 32);
+        if (mpc_re_first(p->data.and.xs[i], set)) {
+          for (j = 0; j < 32; j++) { f[j] |= set[j]; }
+        } else {
+          memcpy(f, set, 32);
+        }
+      }
+      
+      *s = next;
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+static void mpc_nfa_closure(mpc_nfa_t *n, unsigned int *x, int *stack) {
+  
+  int i, q, top = 0;
+  
+  for (i = 0; i < n->num; i++) {
+    if (x[i / 32] & (1u << (i % 32))) { stack[top++] = i; }
+  }
+  
+  while (top) {
+    q = stack[--top];
+    if (n->eps0[q] >= 0 && !(x[n->eps0[q] / 32] & (1u << (n->eps0[q] % 32)))) {
+      x[n->eps0[q] / 32] |= 1u << (n->eps0[q] % 32);
+      stack[top++] = n->eps0[q];
+    }
+    if (n->eps1[q] >= 0 && !(x[n->eps1[q] / 32] & (1u << (n->eps1[q] % 32)))) {
+      x[n->eps1[q] / 32] |= 1u << (n->eps1[q] % 32);
+      stack[top++] = n->eps1[q];
+    }
+  }
+  
+}
+
+static mpc_dfa_t *mpc_dfa_compile(mpc_parser_t *p) {
+  
+  int i, j, c, k, q, s, e;
+  int words, found;
+  unsigned char follow[32];
+  int split[512];
+  unsigned char reps[256];
+  unsigned int *states = NULL, *x;
+  int *stack;
+  mpc_nfa_t n;
+  mpc_dfa_t *d;
+  
+  memset(&n, 0, sizeof(mpc_nfa_t));
+  memset(follow, 0, 32);
+  
+  if (!mpc_re_nfa(&n, p, follow, &s, &e)) {
+    free(n.next); free(n.eps0); free(n.eps1); free(n.sets);
+    return NULL;
+  }
+  
+  d = calloc(1, sizeof(mpc_dfa_t));
+  
+  /* Split bytes into classes no character set tells apart */
+  d->classes_num = 1;
+  for (q = 0; q < n.num; q++) {
+    if (n.next[q] < 0) { continue; }
+    for (j = 0; j < 512; j++) { split[j] = -1; }
+    k = 0;
+    for (c = 0; c < 256; c++) {
+      j = d->classes[c] * 2 + (MPC_SET_HAS(n.sets + 32 * q, c) ? 1 : 0);
+      if (split[j] < 0) { split[j] = k++; }
+      d->classes[c] = split[j];
+    }
+    d->classes_num = k;
+  }
+  for (c = 255; c >= 0; c--) { reps[d->classes[c]] = c; }
+  
+  /* Subset construction, starting from the closure of the start state */
+  words = (n.num + 31) / 32;
+  stack = malloc(sizeof(int) * n.num);
+  x = malloc(sizeof(unsigned int) * words);
+  
+  states = calloc(words, sizeof(unsigned int));
+  states[s / 32] |= 1u << (s % 32);
+  mpc_nfa_closure(&n, states, stack);
+  d->states_num = 1;
+  
+  for (i = 0; i < d->states_num; i++) {
+    
+    d->trans = realloc(d->trans, sizeof(short) * d->classes_num * (i+1));
+    d->accept = realloc(d->accept, i+1);
+    d->accept[i] = (states[i * words + e / 32] >> (e % 32)) & 1;
+    
+    for (k = 0; k < d->classes_num; k++) {
+      
+      memset(x, 0, sizeof(unsigned int) * words);
+      found = 0;
+      for (q = 0; q < n.num; q++) {
+        if ((states[i * words + q / 32] & (1u << (q % 32))) &&
+            n.next[q] >= 0 && MPC_SET_HAS(n.sets + 32 * q, reps[k])) {
+          x[n.next[q] / 32] |= 1u << (n.next[q] % 32);
+          found = 1;
+        }
+      }
+      
+      if (!found) { d->trans[i * d->classes_num + k] = -1; continue; }
+      
+      mpc_nfa_closure(&n, x, stack);
+      for (j = 0; j < d->states_num; j++) {
+        if (memcmp(states + j * words, x, sizeof(unsigned int) * words) == 0) { break; }
+      }
+      
+      if (j == d->states_num) {
+        if (j == MPC_DFA_MAX_STATES) {
+          mpc_dfa_delete(d);
+          d = NULL;
+          goto done;
+        }
+        states = realloc(states, sizeof(unsigned int) * words * (j+1));
+        memcpy(states + j * words, x, sizeof(unsigned int) * words);
+        d->states_num++;
+      }
+      
+      d->trans[i * d->classes_num + k] = j;
+    }
+  }
+  
+done:
+  free(states);
+  free(stack);
+  free(x);
+  free(n.next); free(n.eps0); free(n.eps1); free(n.sets);
+  return d;
+}
+
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *a) {
+  
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_compile(a);
+  if (d == NULL) { return a; }
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = a;
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -2060,7 +3573,7 @@ mpc_parser_t *mpc_re(const char *re) {
   mpc_delete(RegexEnclose);
   mpc_cleanup(5, Regex, Term, Factor, Base, Range);
   
-  return r.output;
+  return mpc_re_dfa(r.output);
   
 }
 
@@ -2365,6 +3878,21 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     free(s);
   }
   
+  if (p->type == MPC_TYPE_CLASS || p->type == MPC_TYPE_SCAN) {
+    e = calloc(1, 256);
+    for (i = 1; i < 256; i++) {
+      if (MPC_SET_HAS(p->data.cls.set, i)) { e[strlen(e)] = (char)i; }
+    }
+    s = mpcf_escape_new(
+      e,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s]", s);
+    if (p->type == MPC_TYPE_SCAN) { printf(p->data.cls.min ? "+" : "*"); }
+    free(s);
+    free(e);
+  }
+  
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
@@ -2375,6 +3903,9 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
   if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
   if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
+  if (p->type == MPC_TYPE_DFA)   { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)  { mpc_print_unretained(p->data.memo.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)  { mpc_print_unretained(p->data.span.x, 0); }
   
   if (p->type == MPC_TYPE_OR) {
     printf("(");
@@ -2426,49 +3957,284 @@ int mpc_test_fail(mpc_parser_t *p, const char *s, const void *d,
   (void) printer;
   if (mpc_parse("<test>", s, p, &r)) {
 
-    if (tester(r.output, d)) {
-      destructor(r.output);
-      return 0;
-    } else {
-      destructor(r.output);
-      return 1;
-    }
-  
-  } else {
-    mpc_err_delete(r.error);
-    return 1;
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 0;
+    } else {
+      destructor(r.output);
+      return 1;
+    }
+  
+  } else {
+    mpc_err_delete(r.error);
+    return 1;
+  }
+  
+}
+
+int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
+  int(*tester)(const void*, const void*), 
+  mpc_dtor_t destructor, 
+  void(*printer)(const void*)) {
+
+  mpc_result_t r;  
+  if (mpc_parse("<test>", s, p, &r)) {
+    
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 1;
+    } else {
+      printf("Got "); printer(r.output); printf("\n");
+      printf("Expected "); printer(d); printf("\n");
+      destructor(r.output);
+      return 0;
+    }
+    
+  } else {    
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 0;
+    
+  }
+  
+}
+
+
+/*
+** AST Tags
+**
+** Every tag string, such as "expr|number|regex",
+** is interned once and never freed. Nodes point
+** at the interned string and carry its index as
+** an integer id. Each id also keeps the ids of
+** the names between its '|'s, so testing a node
+** for a rule name is a few integer compares, and
+** the results of `mpc_ast_add_tag` are cached on
+** the tag they were added to.
+*/
+
+typedef struct {
+  char *tag;
+  int parts_num;
+  int *parts;
+  int adds_num;
+  int *adds;
+} mpc_ast_tag_t;
+
+static mpc_ast_tag_t *mpc_ast_tags = NULL;
+static int mpc_ast_tags_num = 0;
+static int mpc_ast_tags_slots = 0;
+
+/* Open addressed, holding id + 1 or 0 when empty */
+static int *mpc_ast_tags_table = NULL;
+static unsigned long mpc_ast_tags_table_size = 0;
+
+static unsigned long mpc_ast_tag_hash(const char *s, size_t n) {
+  unsigned long h = 5381;
+  size_t i;
+  for (i = 0; i < n; i++) { h = h * 33 + (unsigned char)s[i]; }
+  return h;
+}
+
+static void mpc_ast_tags_rehash(void) {
+  
+  int i;
+  unsigned long j;
+  
+  free(mpc_ast_tags_table);
+  mpc_ast_tags_table_size = mpc_ast_tags_table_size ? mpc_ast_tags_table_size * 2 : 64;
+  mpc_ast_tags_table = calloc(mpc_ast_tags_table_size, sizeof(int));
+  
+  for (i = 0; i < mpc_ast_tags_num; i++) {
+    j = mpc_ast_tag_hash(mpc_ast_tags[i].tag, strlen(mpc_ast_tags[i].tag));
+    while (mpc_ast_tags_table[j & (mpc_ast_tags_table_size-1)]) { j++; }
+    mpc_ast_tags_table[j & (mpc_ast_tags_table_size-1)] = i + 1;
+  }
+}
+
+static int mpc_ast_tag_intern(const char *s, size_t n) {
+  
+  int id, part;
+  unsigned long j;
+  size_t k, l;
+  mpc_ast_tag_t *t;
+  
+  if (mpc_ast_tags_table_size == 0) { mpc_ast_tags_rehash(); }
+  
+  j = mpc_ast_tag_hash(s, n);
+  while ((id = mpc_ast_tags_table[j & (mpc_ast_tags_table_size-1)])) {
+    t = &mpc_ast_tags[id-1];
+    if (strncmp(t->tag, s, n) == 0 && t->tag[n] == '\0') { return id-1; }
+    j++;
+  }
+  
+  if (mpc_ast_tags_num == mpc_ast_tags_slots) {
+    mpc_ast_tags_slots = mpc_ast_tags_slots ? mpc_ast_tags_slots * 2 : 32;
+    mpc_ast_tags = realloc(mpc_ast_tags, sizeof(mpc_ast_tag_t) * mpc_ast_tags_slots);
+  }
+  
+  id = mpc_ast_tags_num++;
+  t = &mpc_ast_tags[id];
+  t->tag = malloc(n + 1);
+  memcpy(t->tag, s, n);
+  t->tag[n] = '\0';
+  t->parts_num = 0;
+  t->parts = NULL;
+  t->adds_num = 0;
+  t->adds = NULL;
+  mpc_ast_tags_table[j & (mpc_ast_tags_table_size-1)] = id + 1;
+  
+  if (mpc_ast_tags_num * 2 > (long)mpc_ast_tags_table_size) { mpc_ast_tags_rehash(); }
+  
+  /* A plain name is its own part, otherwise intern each name */
+  if (memchr(s, '|', n) == NULL) {
+    mpc_ast_tags[id].parts_num = 1;
+    mpc_ast_tags[id].parts = malloc(sizeof(int));
+    mpc_ast_tags[id].parts[0] = id;
+    return id;
+  }
+  
+  for (k = 0; k <= n; k = l + 1) {
+    for (l = k; l < n && s[l] != '|'; l++);
+    part = mpc_ast_tag_intern(s + k, l - k);
+    t = &mpc_ast_tags[id];
+    t->parts = realloc(t->parts, sizeof(int) * (t->parts_num + 1));
+    t->parts[t->parts_num++] = part;
+  }
+  
+  return id;
+}
+
+static int mpc_ast_tag_add(int id, const char *s) {
+  
+  int i, r;
+  size_t n = strlen(s), m;
+  char *b;
+  mpc_ast_tag_t *t = &mpc_ast_tags[id];
+  
+  for (i = 0; i < t->adds_num; i++) {
+    b = mpc_ast_tags[t->adds[i]].tag;
+    if (strncmp(b, s, n) == 0 && b[n] == '|') { return t->adds[i]; }
+  }
+  
+  m = strlen(t->tag);
+  b = malloc(n + 1 + m + 1);
+  memcpy(b, s, n);
+  b[n] = '|';
+  memcpy(b + n + 1, t->tag, m + 1);
+  r = mpc_ast_tag_intern(b, n + 1 + m);
+  free(b);
+  
+  t = &mpc_ast_tags[id];
+  t->adds = realloc(t->adds, sizeof(int) * (t->adds_num + 1));
+  t->adds[t->adds_num++] = r;
+  return r;
+}
+
+int mpc_ast_tag_id(const char *tag) {
+  return mpc_ast_tag_intern(tag, strlen(tag));
+}
+
+/* Tag ids and the tags of any remaining nodes are invalid after this */
+void mpc_ast_tags_cleanup(void) {
+  int i;
+  for (i = 0; i < mpc_ast_tags_num; i++) {
+    free(mpc_ast_tags[i].tag);
+    free(mpc_ast_tags[i].parts);
+    free(mpc_ast_tags[i].adds);
+  }
+  free(mpc_ast_tags);
+  free(mpc_ast_tags_table);
+  mpc_ast_tags = NULL;
+  mpc_ast_tags_num = 0;
+  mpc_ast_tags_slots = 0;
+  mpc_ast_tags_table = NULL;
+  mpc_ast_tags_table_size = 0;
+}
+
+/* Whether `id` is one of the names in the tag of `a` */
+int mpc_ast_has_tag(mpc_ast_t *a, int id) {
+  int i;
+  mpc_ast_tag_t *t = &mpc_ast_tags[a->tag_id];
+  for (i = 0; i < t->parts_num; i++) {
+    if (t->parts[i] == id) { return 1; }
+  }
+  return 0;
+}
+
+/*
+** AST Arena
+**
+** An arena given to `mpc_parse_arena` holds
+** the nodes mpc's AST folds build during that
+** parse, their contents and their child arrays,
+** carved from its chunks. Deleting one of them
+** does nothing, and the whole lot is released
+** at once by clearing or deleting the arena.
+** Each parse may have its own arena.
+*/
+
+typedef struct mpc_ast_chunk_t {
+  struct mpc_ast_chunk_t *next;
+  size_t size;
+  size_t used;
+} mpc_ast_chunk_t;
+
+struct mpc_ast_arena_t {
+  mpc_ast_chunk_t *chunks;
+};
+
+#define MPC_AST_ALIGN (2 * sizeof(void*))
+#define MPC_AST_CHUNK ((sizeof(mpc_ast_chunk_t) + MPC_AST_ALIGN - 1) / MPC_AST_ALIGN * MPC_AST_ALIGN)
+
+mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *r = malloc(sizeof(mpc_ast_arena_t));
+  r->chunks = NULL;
+  return r;
+}
+
+/* Keeps the newest, largest chunk for reuse */
+void mpc_ast_arena_clear(mpc_ast_arena_t *r) {
+  mpc_ast_chunk_t *c, *n;
+  if (r->chunks == NULL) { return; }
+  for (c = r->chunks->next; c; c = n) {
+    n = c->next;
+    free(c);
   }
-  
+  r->chunks->next = NULL;
+  r->chunks->used = MPC_AST_CHUNK;
 }
 
-int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
-  int(*tester)(const void*, const void*), 
-  mpc_dtor_t destructor, 
-  void(*printer)(const void*)) {
+void mpc_ast_arena_delete(mpc_ast_arena_t *r) {
+  mpc_ast_arena_clear(r);
+  free(r->chunks);
+  free(r);
+}
 
-  mpc_result_t r;  
-  if (mpc_parse("<test>", s, p, &r)) {
-    
-    if (tester(r.output, d)) {
-      destructor(r.output);
-      return 1;
-    } else {
-      printf("Got "); printer(r.output); printf("\n");
-      printf("Expected "); printer(d); printf("\n");
-      destructor(r.output);
-      return 0;
-    }
-    
-  } else {    
-    mpc_err_print(r.error);
-    mpc_err_delete(r.error);
-    return 0;
-    
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *r, size_t n) {
+  
+  mpc_ast_chunk_t *c = r->chunks;
+  size_t size;
+  void *x;
+  
+  n = (n + MPC_AST_ALIGN - 1) / MPC_AST_ALIGN * MPC_AST_ALIGN;
+  
+  if (c == NULL || c->used + n > c->size) {
+    size = c ? c->size * 2 : 64 * 1024;
+    if (size > 16 * 1024 * 1024) { size = 16 * 1024 * 1024; }
+    if (size < MPC_AST_CHUNK + n) { size = MPC_AST_CHUNK + n; }
+    c = malloc(size);
+    c->size = size;
+    c->used = MPC_AST_CHUNK;
+    c->next = r->chunks;
+    r->chunks = c;
   }
   
+  x = (char*)c + c->used;
+  c->used += n;
+  return x;
 }
 
-
 /*
 ** AST
 */
@@ -2478,40 +4244,71 @@ void mpc_ast_delete(mpc_ast_t *a) {
   int i;
   
   if (a == NULL) { return; }
+  if (a->arena) { return; }
   for (i = 0; i < a->children_num; i++) {
     mpc_ast_delete(a->children[i]);
   }
   
   free(a->children);
-  free(a->tag);
-  free(a->contents);
   free(a);
   
 }
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->arena) { return; }
   free(a->children);
-  free(a->tag);
-  free(a->contents);
   free(a);
 }
 
-mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+/* The contents are stored after the node, in the same allocation */
+static mpc_ast_t *mpc_ast_alloc(mpc_ast_arena_t *r, int tag_id, const char *contents, size_t n) {
+  
+  mpc_ast_t *a;
   
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+  if (r) {
+    a = mpc_ast_arena_alloc(r, sizeof(mpc_ast_t) + n + 1);
+  } else {
+    a = malloc(sizeof(mpc_ast_t) + n + 1);
+  }
+  a->arena = r;
   
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+  a->tag_id = tag_id;
+  a->tag = mpc_ast_tags[tag_id].tag;
   
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+  a->contents = (char*)(a + 1);
+  memcpy(a->contents, contents, n);
+  a->contents[n] = '\0';
   
   a->state = mpc_state_new();
   
   a->children_num = 0;
+  a->children_slots = 0;
   a->children = NULL;
   return a;
+}
+
+mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  return mpc_ast_alloc(NULL, mpc_ast_tag_id(tag), contents, strlen(contents));
+}
+
+static mpc_ast_t *mpc_ast_copy_to(mpc_ast_arena_t *r, mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *b;
+  
+  if (a == NULL) { return NULL; }
   
+  b = mpc_ast_alloc(r, a->tag_id, a->contents, strlen(a->contents));
+  b->state = a->state;
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_add_child(b, mpc_ast_copy_to(r, a->children[i]));
+  }
+  return b;
+}
+
+/* Copies are always on the heap, so they can outlive an arena */
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  return mpc_ast_copy_to(NULL, a);
 }
 
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
@@ -2540,7 +4337,7 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
   if (a->children_num == 0) { return a; }
   if (a->children_num == 1) { return a; }
 
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_alloc(a->arena, mpc_ast_tag_id(">"), "", 0);
   mpc_ast_add_child(r, a);
   return r;
 }
@@ -2549,7 +4346,7 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
   
   int i;
 
-  if (strcmp(a->tag, b->tag) != 0) { return 0; }
+  if (a->tag_id != b->tag_id) { return 0; }
   if (strcmp(a->contents, b->contents) != 0) { return 0; }
   if (a->children_num != b->children_num) { return 0; }
   
@@ -2561,24 +4358,34 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
 }
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
+  
+  mpc_ast_t **children;
+  
+  if (r->children_num == r->children_slots) {
+    r->children_slots = r->children_slots ? r->children_slots * 2 : 4;
+    if (r->arena) {
+      children = mpc_ast_arena_alloc(r->arena, sizeof(mpc_ast_t*) * r->children_slots);
+      if (r->children_num) { memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num); }
+      r->children = children;
+    } else {
+      r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_slots);
+    }
+  }
+  
+  r->children[r->children_num++] = a;
   return r;
 }
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
   if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
+  a->tag_id = mpc_ast_tag_add(a->tag_id, t);
+  a->tag = mpc_ast_tags[a->tag_id].tag;
   return a;
 }
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
+  a->tag_id = mpc_ast_tag_id(t);
+  a->tag = mpc_ast_tags[a->tag_id].tag;
   return a;
 }
 
@@ -2616,7 +4423,7 @@ void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
   mpc_ast_print_depth(a, 0, fp);
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+static mpc_val_t *mpc_ast_fold(mpc_ast_arena_t *arena, int n, mpc_val_t **xs) {
   
   int i, j;
   mpc_ast_t** as = (mpc_ast_t**)xs;
@@ -2627,7 +4434,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   if (n == 2 && xs[1] == NULL) { return xs[0]; }
   if (n == 2 && xs[0] == NULL) { return xs[1]; }
   
-  r = mpc_ast_new(">", "");
+  r = mpc_ast_alloc(arena, mpc_ast_tag_id(">"), "", 0);
   
   for (i = 0; i < n; i++) {
     
@@ -2654,12 +4461,25 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
   return r;
 }
 
-mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+/* Called directly, the new node goes where its children are */
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (xs[i]) { return mpc_ast_fold(((mpc_ast_t*)xs[i])->arena, n, xs); }
+  }
+  return mpc_ast_fold(NULL, n, xs);
+}
+
+static mpc_val_t *mpc_ast_str(mpc_ast_arena_t *r, mpc_val_t *c) {
+  mpc_ast_t *a = mpc_ast_alloc(r, mpc_ast_tag_id(""), c, strlen(c));
   free(c);
   return a;
 }
 
+mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
+  return mpc_ast_str(NULL, c);
+}
+
 mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
   mpc_state_t *s = ((mpc_state_t**)xs)[0];
   mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
@@ -2966,6 +4786,7 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
   
   mpc_cleanup(5, GrammarTotal, Grammar, Term, Factor, Base);
   
+  mpc_optimise(r.output);
   return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
   
 }
@@ -3046,6 +4867,10 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) {
+      stmt->grammar = mpc_memo(stmt->grammar, (mpc_copy_t)mpc_ast_copy, (mpc_dtor_t)mpc_ast_delete);
+    }
+    mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
     free(stmt->name);
@@ -3178,7 +5003,7 @@ mpc_err_t *mpca_lang(int flags, const char *language, ...) {
   st.parsers = NULL;
   st.flags = flags;
   
-  i = mpc_input_new_string("<mpca_lang>", language);
+  i = mpc_input_new_string("<mpca_lang>", language, strlen(language));
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
@@ -3219,3 +5044,442 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   
   return err;
 }
+
+/*
+** Optimiser
+**
+** Grammars, and most of all those from `mpca_lang`,
+** are deep trees of small parsers, each a frame on
+** the parse stack. These are rewritten in place to
+** fewer, larger parsers giving the same results and
+** the same errors.
+**
+** - An `or` last in another, and the chains of
+**   `and`s built by `mpca_lang`, are flattened.
+** - An `expect` is dropped when one outside it will
+**   replace its error anyway.
+** - Neighbouring alternatives which differ only in
+**   the characters they match become one class.
+** - Repeats of a class folded to a string become a
+**   single scan over the input.
+**
+** Retained parsers may be shared, so they are left
+** alone. Each can be optimised by itself.
+*/
+
+/*
+** `mpca_lang` joins a sequence with nested pairs of
+** `mpcf_fold_ast`. Flattened, folding gives the one
+** result they would have, rather than the ">" node
+** `mpcf_fold_ast` always makes of three or more.
+*/
+
+static mpc_val_t *mpcaf_fold_chain(int n, mpc_val_t **xs) {
+  int i, k = 0, m = 0;
+  for (i = 0; i < n; i++) { if (xs[i]) { k = i; m++; } }
+  if (m == 0) { return NULL; }
+  if (m == 1) { return xs[k]; }
+  return mpcf_fold_ast(n, xs);
+}
+
+static int mpc_optimise_chain(mpc_parser_t *p) {
+  
+  int i;
+  
+  if (p->type != MPC_TYPE_AND) { return 0; }
+  if (p->data.and.f != mpcaf_fold_chain &&
+     (p->data.and.f != mpcf_fold_ast || p->data.and.n != 2)) { return 0; }
+  
+  for (i = 0; i < p->data.and.n-1; i++) {
+    if (p->data.and.dxs[i] != (mpc_dtor_t)mpc_ast_delete) { return 0; }
+  }
+  return 1;
+}
+
+/*
+** Parsers matching a single character from a set
+** which a class can stand in for. Merging classes
+** needs the messages of the `expect`s around them
+** to fail the same way. NUL bytes are never in a
+** class, so parsers which can match them are not.
+**
+** A class merged from all of an `or` stands for it
+** as a whole, and isn't merged again, since its
+** errors are stashed together rather than one by
+** one as those of a split class are.
+*/
+
+static int mpc_optimise_core(mpc_parser_t *p, int messages) {
+  
+  mpc_parser_t *x = p;
+  
+  if (p->retained) { return 0; }
+  if (p->type == MPC_TYPE_CLASS) {
+    return !messages || p->data.cls.n == 1 || (p->data.cls.n > 1 && p->data.cls.split);
+  }
+  
+  if (p->type == MPC_TYPE_EXPECT) {
+    x = p->data.expect.x;
+    if (x->retained) { return 0; }
+  } else if (messages) {
+    return 0;
+  }
+  
+  switch (x->type) {
+    case MPC_TYPE_SINGLE: return x->data.single.x != '\0';
+    case MPC_TYPE_RANGE: return x->data.range.x > 0 || x->data.range.y < 0;
+    case MPC_TYPE_ONEOF: return 1;
+    default: return 0;
+  }
+}
+
+static void mpc_optimise_class(mpc_parser_t *p) {
+  
+  unsigned char *set, *sets = NULL;
+  char **ms = NULL;
+  int n = 0;
+  
+  if (p->type == MPC_TYPE_CLASS) { return; }
+  
+  set = calloc(32, 1);
+  if (p->type == MPC_TYPE_EXPECT) {
+    mpc_re_class(p->data.expect.x, set);
+    ms = malloc(sizeof(char*));
+    ms[n++] = p->data.expect.m;
+    p->data.expect.m = NULL;
+    sets = malloc(32);
+    memcpy(sets, set, 32);
+  } else {
+    mpc_re_class(p, set);
+  }
+  
+  mpc_undefine_unretained(p, 1);
+  p->type = MPC_TYPE_CLASS;
+  p->data.cls.set = set;
+  p->data.cls.min = 0;
+  p->data.cls.n = n;
+  p->data.cls.ms = ms;
+  p->data.cls.sets = sets;
+  p->data.cls.split = 0;
+}
+
+/*
+** Whether `a` and `b` are the same but for a class
+** where consuming the first character, stored in
+** `da` and `db`. Parsers can be shared by pointer
+** when retained, otherwise they must match field
+** by field.
+*/
+
+static int mpc_optimise_eq(mpc_parser_t *a, mpc_parser_t *b, mpc_parser_t **da, mpc_parser_t **db, int path) {
+  
+  int i;
+  
+  if (a == b) { return 1; }
+  if (a->retained || b->retained) { return 0; }
+  
+  if (path && mpc_optimise_core(a, 1) && mpc_optimise_core(b, 1)) {
+    if (*da) { return 0; }
+    *da = a;
+    *db = b;
+    return 1;
+  }
+  
+  if (a->type != b->type) { return 0; }
+  
+  switch (a->type) {
+    
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANY:
+      return 1;
+    
+    case MPC_TYPE_FAIL:     return strcmp(a->data.fail.m, b->data.fail.m) == 0;
+    case MPC_TYPE_LIFT:     return a->data.lift.lf == b->data.lift.lf;
+    case MPC_TYPE_LIFT_VAL: return a->data.lift.x == b->data.lift.x;
+    case MPC_TYPE_ANCHOR:   return a->data.anchor.f == b->data.anchor.f;
+    case MPC_TYPE_SINGLE:   return a->data.single.x == b->data.single.x;
+    case MPC_TYPE_SATISFY:  return a->data.satisfy.f == b->data.satisfy.f;
+    case MPC_TYPE_RANGE:
+      return a->data.range.x == b->data.range.x && a->data.range.y == b->data.range.y;
+    
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_STRING:
+      return strcmp(a->data.string.x, b->data.string.x) == 0;
+    
+    case MPC_TYPE_EXPECT:
+      return strcmp(a->data.expect.m, b->data.expect.m) == 0
+        && mpc_optimise_eq(a->data.expect.x, b->data.expect.x, da, db, 0);
+    
+    case MPC_TYPE_APPLY:
+      return a->data.apply.f == b->data.apply.f
+        && mpc_optimise_eq(a->data.apply.x, b->data.apply.x, da, db, path);
+    
+    case MPC_TYPE_APPLY_TO:
+      return a->data.apply_to.f == b->data.apply_to.f && a->data.apply_to.d == b->data.apply_to.d
+        && mpc_optimise_eq(a->data.apply_to.x, b->data.apply_to.x, da, db, path);
+    
+    case MPC_TYPE_PREDICT: return mpc_optimise_eq(a->data.predict.x, b->data.predict.x, da, db, 0);
+    case MPC_TYPE_SPAN:    return mpc_optimise_eq(a->data.span.x, b->data.span.x, da, db, 0);
+    
+    case MPC_TYPE_MEMO:
+      return a->data.memo.c == b->data.memo.c && a->data.memo.d == b->data.memo.d
+        && mpc_optimise_eq(a->data.memo.x, b->data.memo.x, da, db, 0);
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      return a->data.not.dx == b->data.not.dx && a->data.not.lf == b->data.not.lf
+        && mpc_optimise_eq(a->data.not.x, b->data.not.x, da, db, 0);
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      return a->data.repeat.n == b->data.repeat.n && a->data.repeat.f == b->data.repeat.f
+        && a->data.repeat.dx == b->data.repeat.dx
+        && mpc_optimise_eq(a->data.repeat.x, b->data.repeat.x, da, db, 0);
+    
+    case MPC_TYPE_CLASS:
+    case MPC_TYPE_SCAN:
+      if (a->data.cls.min != b->data.cls.min || a->data.cls.n != b->data.cls.n) { return 0; }
+      if (a->data.cls.split != b->data.cls.split) { return 0; }
+      if (memcmp(a->data.cls.set, b->data.cls.set, 32) != 0) { return 0; }
+      if (a->data.cls.n > 0 && memcmp(a->data.cls.sets, b->data.cls.sets, a->data.cls.n * 32) != 0) { return 0; }
+      for (i = 0; i < a->data.cls.n; i++) {
+        if (strcmp(a->data.cls.ms[i], b->data.cls.ms[i]) != 0) { return 0; }
+      }
+      return 1;
+    
+    case MPC_TYPE_OR:
+      if (a->data.or.n != b->data.or.n) { return 0; }
+      for (i = 0; i < a->data.or.n; i++) {
+        if (!mpc_optimise_eq(a->data.or.xs[i], b->data.or.xs[i], da, db, 0)) { return 0; }
+      }
+      return 1;
+    
+    /* The class can only follow parsers which consume nothing */
+    case MPC_TYPE_AND:
+      if (a->data.and.n != b->data.and.n || a->data.and.f != b->data.and.f) { return 0; }
+      for (i = 0; i < a->data.and.n; i++) {
+        if (i > 0 && a->data.and.dxs[i-1] != b->data.and.dxs[i-1]) { return 0; }
+        if (!mpc_optimise_eq(a->data.and.xs[i], b->data.and.xs[i], da, db, path)) { return 0; }
+        path = path && !a->data.and.xs[i]->retained &&
+          (a->data.and.xs[i]->type == MPC_TYPE_STATE || a->data.and.xs[i]->type == MPC_TYPE_PASS);
+      }
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+static void mpc_optimise_replace(mpc_parser_t *p, mpc_parser_t *x) {
+  p->type = x->type;
+  p->data = x->data;
+  free(x->name);
+  free(x);
+}
+
+static void mpc_optimise_or(mpc_parser_t *p) {
+  
+  int i, j, n = 0, m = 0;
+  mpc_parser_t **xs, **ms, *x, *da, *db;
+  
+  /*
+  ** Flatten the last alternative only, as the errors
+  ** of those before a nested `or` are stashed after
+  ** its own when it succeeds.
+  */
+  for (i = 0; i < p->data.or.n; i++) {
+    x = p->data.or.xs[i];
+    n += (i == p->data.or.n-1 && !x->retained && x->type == MPC_TYPE_OR && x->data.or.n > 0) ? x->data.or.n : 1;
+  }
+  
+  xs = malloc(sizeof(mpc_parser_t*) * n);
+  n = 0;
+  for (i = 0; i < p->data.or.n; i++) {
+    x = p->data.or.xs[i];
+    if (i == p->data.or.n-1 && !x->retained && x->type == MPC_TYPE_OR && x->data.or.n > 0) {
+      for (j = 0; j < x->data.or.n; j++) { xs[n++] = x->data.or.xs[j]; }
+      free(x->data.or.xs);
+      mpc_dispatch_delete(x);
+      free(x->name);
+      free(x);
+    } else {
+      xs[n++] = x;
+    }
+  }
+  free(p->data.or.xs);
+  p->data.or.xs = xs;
+  p->data.or.n = n;
+  
+  /* Merge neighbouring classes */
+  ms = malloc(sizeof(mpc_parser_t*) * n);
+  i = 0;
+  while (i + 1 < p->data.or.n) {
+    
+    da = NULL;
+    db = NULL;
+    if (!mpc_optimise_eq(xs[i], xs[i+1], &da, &db, 1) || !da) { i++; continue; }
+    
+    mpc_optimise_class(da);
+    mpc_optimise_class(db);
+    for (j = 0; j < 32; j++) { da->data.cls.set[j] |= db->data.cls.set[j]; }
+    da->data.cls.ms = realloc(da->data.cls.ms, sizeof(char*) * (da->data.cls.n + db->data.cls.n));
+    da->data.cls.sets = realloc(da->data.cls.sets, 32 * (da->data.cls.n + db->data.cls.n));
+    memcpy(da->data.cls.sets + 32 * da->data.cls.n, db->data.cls.sets, 32 * db->data.cls.n);
+    for (j = 0; j < db->data.cls.n; j++) { da->data.cls.ms[da->data.cls.n++] = db->data.cls.ms[j]; }
+    db->data.cls.n = 0;
+    da->data.cls.split = 1;
+    ms[m++] = da;
+    
+    mpc_undefine_unretained(xs[i+1], 0);
+    p->data.or.n--;
+    for (j = i+1; j < p->data.or.n; j++) { xs[j] = xs[j+1]; }
+  }
+  
+  /* A class merged from the whole `or` fails as one */
+  if (p->data.or.n == 1) {
+    for (i = 0; i < m; i++) { ms[i]->data.cls.split = 0; }
+  }
+  free(ms);
+  
+  if (p->data.or.n == 1 && !xs[0]->retained) {
+    x = xs[0];
+    free(xs);
+    mpc_dispatch_delete(p);
+    mpc_optimise_replace(p, x);
+  }
+  
+}
+
+static void mpc_optimise_and(mpc_parser_t *p) {
+  
+  int i, j, n = 0;
+  mpc_parser_t **xs, *x;
+  mpc_dtor_t *dxs;
+  
+  if (!mpc_optimise_chain(p)) { return; }
+  
+  for (i = 0; i < p->data.and.n; i++) {
+    x = p->data.and.xs[i];
+    n += (!x->retained && mpc_optimise_chain(x)) ? x->data.and.n : 1;
+  }
+  
+  xs = malloc(sizeof(mpc_parser_t*) * n);
+  n = 0;
+  for (i = 0; i < p->data.and.n; i++) {
+    x = p->data.and.xs[i];
+    if (!x->retained && mpc_optimise_chain(x)) {
+      for (j = 0; j < x->data.and.n; j++) { xs[n++] = x->data.and.xs[j]; }
+      free(x->data.and.xs);
+      free(x->data.and.dxs);
+      free(x->name);
+      free(x);
+    } else if (!x->retained && x->type == MPC_TYPE_PASS) {
+      mpc_undefine_unretained(x, 0);
+    } else {
+      xs[n++] = x;
+    }
+  }
+  
+  free(p->data.and.xs);
+  free(p->data.and.dxs);
+  
+  if (n == 1 && !xs[0]->retained) {
+    x = xs[0];
+    free(xs);
+    mpc_optimise_replace(p, x);
+    return;
+  }
+  
+  dxs = malloc(sizeof(mpc_dtor_t) * (n > 1 ? n-1 : 1));
+  for (i = 0; i < n-1; i++) { dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+  
+  p->data.and.n = n;
+  p->data.and.f = mpcaf_fold_chain;
+  p->data.and.xs = xs;
+  p->data.and.dxs = dxs;
+}
+
+static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+  
+  int i;
+  mpc_parser_t **r, *x;
+  
+  if (p->retained && !force) { return; }
+  
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:   mpc_optimise_unretained(p->data.expect.x, 0);   break;
+    case MPC_TYPE_APPLY:    mpc_optimise_unretained(p->data.apply.x, 0);    break;
+    case MPC_TYPE_APPLY_TO: mpc_optimise_unretained(p->data.apply_to.x, 0); break;
+    case MPC_TYPE_PREDICT:  mpc_optimise_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_MEMO:     mpc_optimise_unretained(p->data.memo.x, 0);     break;
+    case MPC_TYPE_SPAN:     mpc_optimise_unretained(p->data.span.x, 0);     break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_optimise_unretained(p->data.not.x, 0);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_optimise_unretained(p->data.repeat.x, 0);
+      break;
+    
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) { mpc_optimise_unretained(p->data.or.xs[i], 0); }
+      break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) { mpc_optimise_unretained(p->data.and.xs[i], 0); }
+      break;
+    
+    default: break;
+  }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_OR:  mpc_optimise_or(p);  break;
+    case MPC_TYPE_AND: mpc_optimise_and(p); break;
+    
+    /* Only this `expect` can be seen through `apply`s */
+    case MPC_TYPE_EXPECT:
+      r = &p->data.expect.x;
+      while (!(*r)->retained) {
+        x = *r;
+        if (x->type == MPC_TYPE_EXPECT) {
+          *r = x->data.expect.x;
+          free(x->data.expect.m);
+          free(x->name);
+          free(x);
+        } else if (x->type == MPC_TYPE_APPLY) {
+          r = &x->data.apply.x;
+        } else if (x->type == MPC_TYPE_APPLY_TO) {
+          r = &x->data.apply_to.x;
+        } else {
+          break;
+        }
+      }
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      x = p->data.repeat.x;
+      if (p->data.repeat.f != mpcf_strfold || !mpc_optimise_core(x, 0)) { break; }
+      mpc_optimise_class(x);
+      x->data.cls.min = p->type == MPC_TYPE_MANY1;
+      x->type = MPC_TYPE_SCAN;
+      mpc_optimise_replace(p, x);
+      break;
+    
+    default: break;
+  }
+  
+}
+
+void mpc_optimise(mpc_parser_t *p) {
+  mpc_optimise_unretained(p, 1);
+  mpc_first_generation++;
+}
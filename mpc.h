@@ -60,6 +60,7 @@ struct mpc_parser_t;
 typedef struct mpc_parser_t mpc_parser_t;
 
 int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_parse_buffer(const char *filename, const char *buffer, long length, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
@@ -74,6 +75,7 @@ typedef mpc_val_t*(*mpc_ctor_t)(void);
 typedef mpc_val_t*(*mpc_apply_t)(mpc_val_t*);
 typedef mpc_val_t*(*mpc_apply_to_t)(mpc_val_t*,void*);
 typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
+typedef mpc_val_t*(*mpc_copy_t)(mpc_val_t*);
 
 /*
 ** Building a Parser
@@ -133,6 +135,21 @@ mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
 
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_copy_t c, mpc_dtor_t da);
+void mpc_memo_limit(size_t bytes);
+
+typedef struct {
+  const char *data;
+  long length;
+  mpc_state_t state;
+  char *copy;
+} mpc_span_t;
+
+mpc_parser_t *mpc_span(mpc_parser_t *a);
+void mpc_span_delete(mpc_val_t *x);
+
+void mpc_optimise(mpc_parser_t *p);
+
 /*
 ** Common Parsers
 */
@@ -257,9 +274,13 @@ typedef struct mpc_ast_t {
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int tag_id;
+  int children_slots;
+  struct mpc_ast_arena_t *arena;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
@@ -271,6 +292,17 @@ void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
 
+int mpc_ast_tag_id(const char *tag);
+int mpc_ast_has_tag(mpc_ast_t *a, int id);
+void mpc_ast_tags_cleanup(void);
+
+typedef struct mpc_ast_arena_t mpc_ast_arena_t;
+
+mpc_ast_arena_t *mpc_ast_arena_new(void);
+int mpc_parse_arena(const char *filename, const char *buffer, long length, mpc_parser_t *p, mpc_result_t *r, mpc_ast_arena_t *a);
+void mpc_ast_arena_clear(mpc_ast_arena_t *r);
+void mpc_ast_arena_delete(mpc_ast_arena_t *r);
+
 /*
 ** Warning: This function currently doesn't test for equality of the `state` member!
 */
@@ -299,7 +331,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -1,11 +1,32 @@
+//mmap and getpid for the JIT
+#define _DEFAULT_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include "mpc.h"
 #include "assert.h"
 #include "declarations.h"
 
 #include <editline/readline.h>
 
+//mapping source files for the mpc readers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && !defined(RYLISP_NO_JIT)
+#define LJIT_ENABLED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef RYLISP_COMPRESSED_REFS
+#include <stdint.h>
+#include <sys/mman.h>
+#endif
+
 //assert macro to simplify error handling
 #define LASSERT(args, cond, fmt, ...) 				\
 	if(!(cond)) { 									\
@@ -16,11 +37,31 @@
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+typedef struct lcode lcode;
+typedef struct lcells lcells;
+
+//reference to an lval from list cells and environments. Built with
+//RYLISP_COMPRESSED_REFS, every lval lives in one reserved arena and is
+//referenced by a 32 bit offset into it, in units of 16 bytes, which
+//halves the size of cells and bindings and keeps lvals packed together
+#ifdef RYLISP_COMPRESSED_REFS
+typedef uint32_t lref;
+static char* larena_base = NULL;
+#define LPTR(r) ((lval*)(larena_base + ((size_t)(r) << 4)))
+#define LREF(v) ((lref)(((char*)(v) - larena_base) >> 4))
+#else
+typedef lval* lref;
+#define LPTR(r) (r)
+#define LREF(v) (v)
+#endif
+
 //Lisp Value
 struct lval {
 	int type;
+	//set when the value lives in the open region, see lregion_begin
+	int region;
 	
-	//basic
+	//basic. Lists keep LNUM_NEVER here instead, see lval_num_ok
 	long num;
 	char* err;
 	char* sym;
@@ -30,33 +71,616 @@ struct lval {
 	lenv* env;
 	lval* formals;
 	lval* body;
+	lcode* code;
 
-	//expression 
+	//expression. cell points into cells, which copies of the list share
+	//until one of them writes, see lval_own
 	int count;
-	lval** cell;
+	lref* cell;
+	lcells* cells;
 };
 
 //Lisp environment
 struct lenv{
 	lenv* par;
 	int count;
+	//where syms and vals live, see LENV_* below
+	int frame;
 	char** syms;
-	lval** vals;
+	lref* vals;
 };
 
-enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
+enum { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_RECUR };
+
+//lenv storage: heap arrays, a let frame on the C stack which spills to the
+//heap when it grows, or a loop frame whose unknown names go to the parent
+enum { LENV_HEAP, LENV_LET, LENV_LOOP };
 
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
 
+//state shared by every copy of a lambda, so call counts and native code
+//survive the copies made by lenv_get and lval_call
+struct lcode {
+	int refs;
+	long calls;
+	int state;
+	//argument types seen while cold, as a mask of 1 << type
+	unsigned seen;
+	//times typed code has been dropped after a guard failed
+	int deopts;
+	//name the lambda was first defined under, for the perf map
+	char* name;
+	int slots;
+	//first slot filled from a free variable rather than an argument or let
+	int vars;
+	ljit_fn native;
+	void* mem;
+	size_t size;
+	//body in the integer IR, once inferred to only compute on numbers
+	lint* ints;
+	//builtins, lambdas and variables the typed code assumed, checked per call
+	lval* guards;
+	//set once typed code found a lambda it calls no longer typed
+	int stale;
+};
+
+enum { LJIT_COLD, LJIT_TYPED, LJIT_NATIVE, LJIT_UNSUPPORTED };
+
+//cell storage of a list. A copy of a list shares it and takes a reference,
+//and a list that shares its cells may view only a suffix of them, as left
+//by tail. The elements belong to the storage, not to any one view
+struct lcells {
+	int refs;
+	//set when the storage lives in the open region
+	int region;
+	//set while the open region holds a reference, see lregion_pin
+	int pinned;
+	//set for storage in the hash-cons table, which is never written
+	int consed;
+	int cap;
+	//elements held, as of the last time the storage was shared
+	int count;
+	//link while on a free list
+	lcells* next;
+	lref cell[];
+};
+
+//number of power of two cell array sizes kept on free lists
+#define LCELL_CLASSES 8
+
+//free lists for lval structs and small cell arrays, so that loops and
+//other hot paths recycle memory instead of going through malloc and free
+static lval* lval_free_list = NULL;
+static lcells* lcell_free_list[LCELL_CLASSES];
+
+//region for the temporaries of one top level REPL form. Values allocated
+//while it is open come from large chunks, are recycled among themselves,
+//and are all dropped at once when it closes. Anything that has to outlive
+//the form is copied out with lval_promote
+#define LREGION_CHUNK (1 << 20)
+
+typedef struct lchunk {
+	struct lchunk* next;
+	size_t used;
+	size_t size;
+	//keeps data 16 byte aligned, as compressed references need
+	size_t pad;
+	char data[];
+} lchunk;
+
+static lchunk* lregion_chunks = NULL;
+#ifdef RYLISP_COMPRESSED_REFS
+//chunks are arena memory, so closed regions keep theirs for the next one
+static lchunk* lregion_spare = NULL;
+#endif
+//environment whose bindings outlive the region, set while it is open
+static lenv* lregion_root = NULL;
+//nesting of sections that allocate on the heap while the region is open
+static int lregion_heap = 0;
+static lval* lregion_free_list = NULL;
+static lcells* lregion_cell_free_list[LCELL_CLASSES];
+//functions and errors in the region, which own memory outside of it.
+//Each one keeps its index here in its unused count field
+static lval** lregion_owners = NULL;
+static int lregion_owner_count = 0;
+static int lregion_owner_cap = 0;
+//heap cell storage shared by lists in the region, each referenced once
+static lcells** lregion_pins = NULL;
+static int lregion_pin_count = 0;
+static int lregion_pin_cap = 0;
+
+#ifdef RYLISP_COMPRESSED_REFS
+//address space reserved for the arena, and committed in steps as it fills
+#define LARENA_RESERVE ((size_t)1 << 36)
+#define LARENA_COMMIT ((size_t)1 << 24)
+static size_t larena_used = 0;
+static size_t larena_committed = 0;
+
+void* larena_alloc(size_t n){
+	if(!larena_base){
+		larena_base = mmap(NULL, LARENA_RESERVE, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if(larena_base == MAP_FAILED){
+			fputs("Could not reserve the lval arena\n", stderr);
+			exit(1);
+		}
+		//offset 0 is never handed out
+		larena_used = 16;
+	}
+	n = (n + 15) & ~(size_t)15;
+	if(larena_used + n > larena_committed){
+		size_t size = (larena_used + n - larena_committed + LARENA_COMMIT - 1) & ~(LARENA_COMMIT - 1);
+		if(larena_committed + size > LARENA_RESERVE
+			|| mprotect(larena_base + larena_committed, size, PROT_READ | PROT_WRITE) != 0){
+			fputs("Out of lval arena space\n", stderr);
+			exit(1);
+		}
+		larena_committed += size;
+	}
+	void* p = larena_base + larena_used;
+	larena_used += n;
+	return p;
+}
+#endif
+
+lchunk* lchunk_new(size_t size){
+	lchunk* c;
+#ifdef RYLISP_COMPRESSED_REFS
+	for(lchunk** s = &lregion_spare; *s; s = &(*s)->next){
+		if((*s)->size >= size){
+			c = *s;
+			*s = c->next;
+			return c;
+		}
+	}
+	c = larena_alloc(sizeof(lchunk) + size);
+#else
+	c = malloc(sizeof(lchunk) + size);
+#endif
+	c->size = size;
+	return c;
+}
+
+void lchunk_free(lchunk* c){
+#ifdef RYLISP_COMPRESSED_REFS
+	c->next = lregion_spare;
+	lregion_spare = c;
+#else
+	free(c);
+#endif
+}
+
+int lregion_open(void){
+	return lregion_root && !lregion_heap;
+}
+
+void* lregion_alloc(size_t n){
+	n = (n + 15) & ~(size_t)15;
+	lchunk* c = lregion_chunks;
+	if(!c || c->used + n > c->size){
+		size_t size = n > LREGION_CHUNK ? n : LREGION_CHUNK;
+		c = lchunk_new(size);
+		c->next = lregion_chunks;
+		c->used = 0;
+		lregion_chunks = c;
+	}
+	void* p = c->data + c->used;
+	c->used += n;
+	return p;
+}
+
+//register a region value that owns memory outside the region
+void lregion_own(lval* v){
+	if(!v->region) { return; }
+	if(lregion_owner_count == lregion_owner_cap){
+		lregion_owner_cap = lregion_owner_cap ? lregion_owner_cap * 2 : 64;
+		lregion_owners = realloc(lregion_owners, sizeof(lval*) * lregion_owner_cap);
+	}
+	v->count = lregion_owner_count;
+	lregion_owners[lregion_owner_count++] = v;
+}
+
+lval* lval_alloc(void){
+	lval* v;
+	if(lregion_open()){
+		v = lregion_free_list;
+		if(v){
+			lregion_free_list = v->formals;
+		} else {
+			v = lregion_alloc(sizeof(lval));
+		}
+		v->region = 1;
+		return v;
+	}
+
+	v = lval_free_list;
+	if(v){
+		lval_free_list = v->formals;
+	} else {
+#ifdef RYLISP_COMPRESSED_REFS
+		v = larena_alloc(sizeof(lval));
+#else
+		v = malloc(sizeof(lval));
+#endif
+	}
+	v->region = 0;
+	return v;
+}
+
+void lval_free(lval* v){
+	lval** list = v->region ? &lregion_free_list : &lval_free_list;
+	v->formals = *list;
+	*list = v;
+}
+
+int lcell_class(int cap){
+	int c = 0;
+	while((1 << c) < cap) { c++; }
+	return c;
+}
+
+//allocate storage for at least n cells, rounding up to a power of two,
+//for a list in the region or on the heap
+lcells* lcell_alloc(int n, int region){
+	int c = lcell_class(n);
+	lcells** lists = region ? lregion_cell_free_list : lcell_free_list;
+	lcells* b;
+	if(c < LCELL_CLASSES && lists[c]){
+		b = lists[c];
+		lists[c] = b->next;
+	} else {
+		size_t size = sizeof(lcells) + sizeof(lref) * (1 << c);
+		b = region ? lregion_alloc(size) : malloc(size);
+	}
+	b->refs = 1;
+	b->region = region;
+	b->pinned = 0;
+	b->consed = 0;
+	b->cap = 1 << c;
+	b->count = 0;
+	return b;
+}
+
+void lcell_free(lcells* b){
+	int c = lcell_class(b->cap);
+	lcells** lists = b->region ? lregion_cell_free_list : lcell_free_list;
+	if(c < LCELL_CLASSES){
+		b->next = lists[c];
+		lists[c] = b;
+	} else if(!b->region){
+		free(b);
+	}
+}
+
+void lcons_remove(lcells* b);
+
+//drop a reference to cell storage, deleting its n elements with the last
+void lcell_drop(lcells* b, int n){
+	if(--b->refs > 0) { return; }
+	if(b->consed) { lcons_remove(b); }
+	for(int i = 0; i < n; i++){
+		lval_delete(LPTR(b->cell[i]));
+	}
+	lcell_free(b);
+}
+
+//drop the reference v holds to its cells. A list in the region viewing
+//heap storage holds none, the region itself does until it closes
+void lcell_release(lval* v){
+	lcells* b = v->cells;
+	if(!b || (v->region && !b->region)) { return; }
+	lcell_drop(b, v->cell == b->cell ? v->count : b->count);
+}
+
+//let the open region hold a reference to heap storage viewed from it
+void lregion_pin(lcells* b){
+	if(b->pinned) { return; }
+	if(lregion_pin_count == lregion_pin_cap){
+		lregion_pin_cap = lregion_pin_cap ? lregion_pin_cap * 2 : 64;
+		lregion_pins = realloc(lregion_pins, sizeof(lcells*) * lregion_pin_cap);
+	}
+	b->pinned = 1;
+	b->refs++;
+	lregion_pins[lregion_pin_count++] = b;
+}
+
+//whether v may write its cells in place
+int lval_owned(lval* v){
+	lcells* b = v->cells;
+	return !b || (b->refs == 1 && !b->consed && b->region == v->region && v->cell == b->cell);
+}
+
+//whether v views the whole of hash-consed storage
+int lval_consed(lval* v){
+	return v->cells && v->cells->consed && v->cell == v->cells->cell;
+}
+
+//make v the sole owner of its cells before it writes them. Shared cells
+//are copied one level deep, the elements' own cells stay shared
+void lval_own(lval* v){
+	if(lval_owned(v)) { return; }
+	lcells* b = NULL;
+	if(v->count){
+		if(!v->region) { lregion_heap++; }
+		b = lcell_alloc(v->count, v->region);
+		for(int i = 0; i < v->count; i++){
+			b->cell[i] = LREF(lval_copy(LPTR(v->cell[i])));
+		}
+		if(!v->region) { lregion_heap--; }
+	}
+	lcell_release(v);
+	v->cells = b;
+	v->cell = b ? b->cell : NULL;
+}
+
+//hash-consing of quoted data, enabled with --hash-cons. Lists made only of
+//numbers, symbols and such lists keep their cells in heap storage that is
+//shared by every structurally equal list, so equal data is stored once and
+//compares by pointer. The table does not hold references: storage leaves
+//it when the last list viewing it is deleted
+static int lcons_enabled = 0;
+static lcells** lcons_table = NULL;
+static int lcons_count = 0;
+static int lcons_used = 0;
+static int lcons_cap = 0;
+#define LCONS_DEAD ((lcells*)1)
+
+//what identifies an element c of consed storage, given the consed
+//storage sub of its own elements, if any
+unsigned long lcons_key(lval* c, lcells* sub){
+	switch(c->type){
+		case LVAL_NUM: return (unsigned long)c->num;
+		case LVAL_SYM: return (unsigned long)c->sym;
+		default: return (unsigned long)sub;
+	}
+}
+
+unsigned long lcons_hash(lref* cell, lcells** sub, int n){
+	unsigned long h = 5381 + n;
+	for(int i = 0; i < n; i++){
+		h = h * 33 + LPTR(cell[i])->type;
+		h = h * 33 + lcons_key(LPTR(cell[i]), sub[i]);
+	}
+	return h;
+}
+
+//hash of storage already in the table
+unsigned long lcons_hash_cells(lcells* b){
+	lcells* sub[b->count + 1];
+	for(int i = 0; i < b->count; i++) { sub[i] = LPTR(b->cell[i])->cells; }
+	return lcons_hash(b->cell, sub, b->count);
+}
+
+void lcons_grow(void){
+	int cap = lcons_cap ? lcons_cap * 2 : 256;
+	if(lcons_count * 4 < lcons_cap) { cap = lcons_cap; }
+	lcells** table = calloc(cap, sizeof(lcells*));
+	for(int i = 0; i < lcons_cap; i++){
+		lcells* b = lcons_table[i];
+		if(!b || b == LCONS_DEAD) { continue; }
+		unsigned long j = lcons_hash_cells(b) & (cap - 1);
+		while(table[j]) { j = (j + 1) & (cap - 1); }
+		table[j] = b;
+	}
+	free(lcons_table);
+	lcons_table = table;
+	lcons_cap = cap;
+	lcons_used = lcons_count;
+}
+
+void lcons_remove(lcells* b){
+	unsigned long i = lcons_hash_cells(b) & (lcons_cap - 1);
+	while(lcons_table[i] != b) { i = (i + 1) & (lcons_cap - 1); }
+	lcons_table[i] = LCONS_DEAD;
+	lcons_count--;
+}
+
+//consed storage equal to the cells of v, with a reference taken on it,
+//or NULL if v holds anything but numbers, symbols and lists of them
+lcells* lcons_cells(lval* v){
+	if(lval_consed(v)){
+		v->cells->refs++;
+		return v->cells;
+	}
+
+	int n = v->count;
+	lcells* sub[n + 1];
+	for(int i = 0; i < n; i++){
+		lval* c = LPTR(v->cell[i]);
+		sub[i] = NULL;
+		if(c->type == LVAL_NUM || c->type == LVAL_SYM) { continue; }
+		if((c->type == LVAL_SEXPR || c->type == LVAL_QEXPR) && !c->count) { continue; }
+		if(c->type == LVAL_SEXPR || c->type == LVAL_QEXPR) { sub[i] = lcons_cells(c); }
+		if(!sub[i]){
+			while(i--) { if(sub[i]) { lcell_drop(sub[i], sub[i]->count); } }
+			return NULL;
+		}
+	}
+
+	if((lcons_used + 1) * 2 >= lcons_cap) { lcons_grow(); }
+	unsigned long h = lcons_hash(v->cell, sub, n);
+	unsigned long i = h & (lcons_cap - 1);
+	long dead = -1;
+	for(; lcons_table[i]; i = (i + 1) & (lcons_cap - 1)){
+		lcells* b = lcons_table[i];
+		if(b == LCONS_DEAD){
+			if(dead < 0) { dead = i; }
+			continue;
+		}
+		if(b->count != n) { continue; }
+		int same = 1;
+		for(int k = 0; k < n && same; k++){
+			lval* c = LPTR(b->cell[k]);
+			same = c->type == LPTR(v->cell[k])->type
+				&& lcons_key(c, c->cells) == lcons_key(LPTR(v->cell[k]), sub[k]);
+		}
+		if(!same) { continue; }
+
+		//the elements of b already hold their references
+		for(int k = 0; k < n; k++){
+			if(sub[k]) { lcell_drop(sub[k], sub[k]->count); }
+		}
+		b->refs++;
+		return b;
+	}
+
+	//not seen before, build it on the heap with the references taken above
+	lregion_heap++;
+	lcells* b = lcell_alloc(n, 0);
+	for(int k = 0; k < n; k++){
+		lval* c = LPTR(v->cell[k]);
+		if(!sub[k]) {
+			b->cell[k] = LREF(lval_copy(c));
+			continue;
+		}
+		lval* x = lval_alloc();
+		x->type = c->type;
+		x->num = c->num;
+		x->count = c->count;
+		x->cells = sub[k];
+		x->cell = sub[k]->cell;
+		b->cell[k] = LREF(x);
+	}
+	lregion_heap--;
+	b->consed = 1;
+	b->count = n;
+
+	if(dead < 0) { lcons_used++; } else { i = dead; }
+	lcons_table[i] = b;
+	lcons_count++;
+	return b;
+}
+
+//replace the cells of a list with their hash-consed storage, if it has any
+lval* lval_cons(lval* v){
+	if((v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) || !v->count) { return v; }
+	lcells* b = lcons_cells(v);
+	if(!b || b == v->cells) {
+		if(b) { lcell_drop(b, b->count); }
+		return v;
+	}
+	lcell_release(v);
+	v->cells = b;
+	v->cell = b->cell;
+
+	//a list in the region reaches heap storage through the region
+	if(v->region){
+		lregion_pin(b);
+		lcell_drop(b, b->count);
+	}
+	return v;
+}
+
+//symbol table. Every symbol string is interned here and never freed,
+//so symbols copy by pointer and compare with ==
+static char** lsym_table = NULL;
+static int lsym_count = 0;
+static int lsym_cap = 0;
+
+unsigned long lsym_hash(char* s, size_t n){
+	unsigned long h = 5381;
+	while(n--) { h = h * 33 + (unsigned char)*s++; }
+	return h;
+}
+
+//intern the n characters at s, which need not be terminated
+char* lsym_intern_len(char* s, size_t n){
+	//keep the table at most half full
+	if(lsym_count * 2 >= lsym_cap){
+		int cap = lsym_cap ? lsym_cap * 2 : 256;
+		char** table = calloc(cap, sizeof(char*));
+		for(int i = 0; i < lsym_cap; i++){
+			if(!lsym_table[i]) { continue; }
+			unsigned long j = lsym_hash(lsym_table[i], strlen(lsym_table[i])) & (cap - 1);
+			while(table[j]) { j = (j + 1) & (cap - 1); }
+			table[j] = lsym_table[i];
+		}
+		free(lsym_table);
+		lsym_table = table;
+		lsym_cap = cap;
+	}
+
+	unsigned long i = lsym_hash(s, n) & (lsym_cap - 1);
+	while(lsym_table[i]){
+		if(strncmp(lsym_table[i], s, n) == 0 && lsym_table[i][n] == '\0') { return lsym_table[i]; }
+		i = (i + 1) & (lsym_cap - 1);
+	}
+	lsym_table[i] = malloc(n + 1);
+	memcpy(lsym_table[i], s, n);
+	lsym_table[i][n] = '\0';
+	lsym_count++;
+	return lsym_table[i];
+}
+
+char* lsym_intern(char* s){
+	return lsym_intern_len(s, strlen(s));
+}
+
+lcode* lcode_new(void){
+	lcode* c = malloc(sizeof(lcode));
+	c->refs = 1;
+	c->calls = 0;
+	c->state = LJIT_COLD;
+	c->seen = 0;
+	c->deopts = 0;
+	c->name = NULL;
+	c->native = NULL;
+	c->mem = NULL;
+	c->ints = NULL;
+	c->guards = NULL;
+	c->stale = 0;
+	return c;
+}
+
+void lcode_release(lcode* c){
+	if(--c->refs > 0) { return; }
+#ifdef LJIT_ENABLED
+	if(c->mem) { munmap(c->mem, c->size); }
+#endif
+	if(c->ints) { lint_del(c->ints); }
+	if(c->guards) { lval_delete(c->guards); }
+	free(c);
+}
+
+//open a region for one top level form evaluated in root
+void lregion_begin(lenv* root){
+	lregion_root = root;
+}
+
+//close the region. Only functions and errors still alive in it are
+//visited, to release what they own elsewhere; every other value goes
+//with its chunk, however large the structure it was part of
+void lregion_end(void){
+	for(int i = 0; i < lregion_owner_count; i++){
+		if(lregion_owners[i]) { lval_delete(lregion_owners[i]); }
+	}
+	lregion_owner_count = 0;
+	for(int i = 0; i < lregion_pin_count; i++){
+		lregion_pins[i]->pinned = 0;
+		lcell_drop(lregion_pins[i], lregion_pins[i]->count);
+	}
+	lregion_pin_count = 0;
+	lregion_root = NULL;
+
+	while(lregion_chunks && lregion_chunks->next){
+		lchunk* next = lregion_chunks->next;
+		lchunk_free(lregion_chunks);
+		lregion_chunks = next;
+	}
+	if(lregion_chunks) { lregion_chunks->used = 0; }
+	lregion_free_list = NULL;
+	for(int i = 0; i < LCELL_CLASSES; i++) { lregion_cell_free_list[i] = NULL; }
+}
+
 lval* lval_num(long x){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_NUM;
 	v->num = x;
 	return v;
 }
 
 lval* lval_err(char* fmt, ...){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_ERR;
 	
 	//create vararg list and initialize it
@@ -75,37 +699,41 @@ lval* lval_err(char* fmt, ...){
 	//clean up vararg list
 	va_end(va);
 
+	lregion_own(v);
 	return v;
 }
 
 lval* lval_sym(char* s){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_SYM;
-	v->sym = malloc(strlen(s) + 1);
-	strcpy(v->sym, s);
+	v->sym = lsym_intern(s);
 	return v;
 }
 
 lval* lval_sexpr(void){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_SEXPR;
+	v->num = 0;
 	v->count = 0;
 	v->cell = NULL;
+	v->cells = NULL;
 	return v;
 }
 
 //pointer to a new empty Qexpr lval
 lval* lval_qexpr(void){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_QEXPR;
+	v->num = 0;
 	v->count = 0;
 	v->cell = NULL;
+	v->cells = NULL;
 	return v;
 }
 
 //constructor for user defined functions
 lval* lval_lambda(lval* formals, lval* body){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_FUN;
 
 	//set builtin to null
@@ -117,6 +745,8 @@ lval* lval_lambda(lval* formals, lval* body){
 	//set formals and body
 	v->formals = formals;
 	v->body = body;
+	v->code = lcode_new();
+	lregion_own(v);
 	return v;
 }
 
@@ -128,22 +758,43 @@ lval* lval_read_num(mpc_ast_t* t){
 }
 
 lval* lval_add(lval* v, lval* x) {
-	v->count++;
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-	v->cell[v->count - 1] = x;
+	lval_own(v);
+
+	//grow the cell array by doubling when it is full
+	if(!v->cells || v->count == v->cells->cap){
+		lcells* b = lcell_alloc(v->count + 1, v->region);
+		if(v->count) { memcpy(b->cell, v->cell, sizeof(lref) * v->count); }
+		if(v->cells) { lcell_free(v->cells); }
+		v->cells = b;
+		v->cell = b->cell;
+	}
+	v->cell[v->count++] = LREF(x);
 	return v;
 }
 
+//interned ids of the grammar's tags, so lval_read tests integers rather
+//than searching tag strings
+static int ltag_number = -1, ltag_symbol, ltag_sexpr, ltag_qexpr, ltag_root, ltag_regex;
+
 lval* lval_read(mpc_ast_t* t){
+	if(ltag_number < 0){
+		ltag_number = mpc_ast_tag_id("number");
+		ltag_symbol = mpc_ast_tag_id("symbol");
+		ltag_sexpr  = mpc_ast_tag_id("sexpr");
+		ltag_qexpr  = mpc_ast_tag_id("qexpr");
+		ltag_root   = mpc_ast_tag_id(">");
+		ltag_regex  = mpc_ast_tag_id("regex");
+	}
+
 	//if symbol or number, return conversion to that type
-	if(strstr(t->tag, "number")) { return lval_read_num(t); }
-	if(strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+	if(mpc_ast_has_tag(t, ltag_number)) { return lval_read_num(t); }
+	if(mpc_ast_has_tag(t, ltag_symbol)) { return lval_sym(t->contents); }
 
 	//if root (>) or sexpr then create empty list
 	lval* x = NULL;
-	if(strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-	if(strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
-	if(strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
+	if(t->tag_id == ltag_root)         { x = lval_sexpr(); }
+	if(mpc_ast_has_tag(t, ltag_sexpr)) { x = lval_sexpr(); }
+	if(mpc_ast_has_tag(t, ltag_qexpr)) { x = lval_qexpr(); }
 
 	//fill in this list with any valid expressions contained in it
 	for(int i = 0; i < t->children_num; i++){
@@ -151,9 +802,206 @@ lval* lval_read(mpc_ast_t* t){
 		if(strcmp(t->children[i]->contents, ")") == 0 ) { continue; }
 		if(strcmp(t->children[i]->contents, "{") == 0 ) { continue; }
 		if(strcmp(t->children[i]->contents, "}") == 0 ) { continue; }
-		if(strcmp(t->children[i]->tag, "regex") == 0 ) { continue; }	
+		if(t->children[i]->tag_id == ltag_regex) { continue; }
 		x = lval_add(x, lval_read(t->children[i]));
 	}
+
+	//quoted data is immutable, so equal literals can share storage
+	if(lcons_enabled && x->type == LVAL_QEXPR) { x = lval_cons(x); }
+	return x;
+}
+
+//the number in the n characters at s, an optional '-' then digits. They
+//needn't be NUL terminated. Negative numbers accumulate downward so that
+//LONG_MIN is in range
+lval* lread_num(const char* s, size_t n){
+	int neg = *s == '-';
+	long x = 0;
+	for(size_t i = neg; i < n; i++){
+		//stop before a digit would take x out of range
+		int d = s[i] - '0';
+		if(neg ? x < (LONG_MIN + d) / 10 : x > (LONG_MAX - d) / 10) { return lval_err("invalid number"); }
+		x = neg ? x * 10 - d : x * 10 + d;
+	}
+	return lval_num(x);
+}
+
+//mpc fold callbacks for the combinator grammar in main. They build lvals
+//as each rule matches, so parsing makes no AST and needs no lval_read walk.
+//Tokens arrive as spans of the source, so none are copied out of it
+mpc_val_t* lread_fold_num(mpc_val_t* s){
+	mpc_span_t* t = s;
+	lval* v = lread_num(t->data, t->length);
+	mpc_span_delete(t);
+	return v;
+}
+
+mpc_val_t* lread_fold_sym(mpc_val_t* s){
+	mpc_span_t* t = s;
+	lval* v = lval_alloc();
+	v->type = LVAL_SYM;
+	v->sym = lsym_intern_len((char*)t->data, t->length);
+	mpc_span_delete(t);
+	return v;
+}
+
+mpc_val_t* lread_fold_list(int n, mpc_val_t** xs){
+	lval* x = lval_sexpr();
+	for(int i = 0; i < n; i++) { lval_add(x, xs[i]); }
+	return x;
+}
+
+//drop the brackets from '(' <list> ')'
+mpc_val_t* lread_fold_sexpr(int n, mpc_val_t** xs){
+	free(xs[0]);
+	free(xs[2]);
+	return xs[1];
+}
+
+mpc_val_t* lread_fold_qexpr(int n, mpc_val_t** xs){
+	lval* x = lread_fold_sexpr(n, xs);
+	x->type = LVAL_QEXPR;
+	if(lcons_enabled) { x = lval_cons(x); }
+	return x;
+}
+
+//destructor for partial results when a rule fails after matching a list
+void lread_fold_del(mpc_val_t* x){
+	lval_delete(x);
+}
+
+//hand-written reader. It scans the source text once, building lvals as it
+//goes, and accepts the same language as the mpc grammar in main: numbers
+///-?[0-9]+/, symbols, (s-expressions) and {q-expressions} separated by
+//whitespace. Errors are reported with the row and column like mpc's
+enum { LREAD_SPACE = 1, LREAD_DIGIT = 2, LREAD_SYMBOL = 4 };
+
+static unsigned char lread_class[256];
+
+void lread_init(void){
+	if(lread_class['0']) { return; }
+	for(char* c = " \t\n\r\f\v"; *c; c++) { lread_class[(unsigned char)*c] = LREAD_SPACE; }
+	for(char* c = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_+-*/\\=<>!&"; *c; c++){
+		lread_class[(unsigned char)*c] = LREAD_SYMBOL;
+	}
+	for(char c = '0'; c <= '9'; c++) { lread_class[(unsigned char)c] = LREAD_DIGIT | LREAD_SYMBOL; }
+}
+
+typedef struct {
+	char* name;
+	char* s;
+	//start of the current line, for the column
+	char* line;
+	int row;
+	//set once the reader has failed, with its message
+	char* err;
+} lreader;
+
+void lread_space(lreader* r){
+	while(lread_class[(unsigned char)*r->s] & LREAD_SPACE){
+		if(*r->s == '\n'){
+			r->row++;
+			r->line = r->s + 1;
+		}
+		r->s++;
+	}
+}
+
+void lread_fail(lreader* r, char* expected){
+	char found[16];
+	if(*r->s) {
+		snprintf(found, sizeof(found), "'%c'", *r->s);
+	} else {
+		strcpy(found, "end of input");
+	}
+	size_t n = strlen(r->name) + strlen(expected) + 64;
+	r->err = malloc(n);
+	snprintf(r->err, n, "%s:%i:%i: error: expected %s at %s\n",
+		r->name, r->row, (int)(r->s - r->line) + 1, expected, found);
+}
+
+//whether an expression can start with c
+int lread_starts(char c){
+	return (lread_class[(unsigned char)c] & LREAD_SYMBOL) || c == '(' || c == '{';
+}
+
+lval* lread_expr(lreader* r);
+
+//the elements of a list up to its closing bracket
+lval* lread_list(lreader* r, lval* x, char close){
+	while(1){
+		lread_space(r);
+		if(*r->s == close){
+			r->s++;
+			break;
+		}
+		lval* y = NULL;
+		if(lread_starts(*r->s)){
+			y = lread_expr(r);
+		} else {
+			lread_fail(r, close == ')' ? "expression or ')'" : "expression or '}'");
+		}
+		if(!y){
+			lval_delete(x);
+			return NULL;
+		}
+		lval_add(x, y);
+	}
+
+	//quoted data is immutable, so equal literals can share storage
+	if(lcons_enabled && x->type == LVAL_QEXPR) { x = lval_cons(x); }
+	return x;
+}
+
+//read the expression at r, which lread_starts has accepted
+lval* lread_expr(lreader* r){
+	char* s = r->s;
+	unsigned char c = *s;
+
+	//numbers are parsed in place
+	if((lread_class[c] & LREAD_DIGIT) || (c == '-' && (lread_class[(unsigned char)s[1]] & LREAD_DIGIT))){
+		if(c == '-') { s++; }
+		while(lread_class[(unsigned char)*s] & LREAD_DIGIT) { s++; }
+		lval* v = lread_num(r->s, s - r->s);
+		r->s = s;
+		return v;
+	}
+
+	if(lread_class[c] & LREAD_SYMBOL){
+		while(lread_class[(unsigned char)*s] & LREAD_SYMBOL) { s++; }
+		lval* v = lval_alloc();
+		v->type = LVAL_SYM;
+		v->sym = lsym_intern_len(r->s, s - r->s);
+		r->s = s;
+		return v;
+	}
+
+	r->s++;
+	return c == '(' ? lread_list(r, lval_sexpr(), ')') : lread_list(r, lval_qexpr(), '}');
+}
+
+//read every form in input into an s-expression. On a syntax error the
+//message is stored in *err, to be freed by the caller, and NULL returned
+lval* lval_read_text(char* name, char* input, char** err){
+	lread_init();
+	lreader r = { name, input, input, 1, NULL };
+	lval* x = lval_sexpr();
+	while(1){
+		lread_space(&r);
+		if(!*r.s) { break; }
+		lval* y = NULL;
+		if(lread_starts(*r.s)){
+			y = lread_expr(&r);
+		} else {
+			lread_fail(&r, "expression or end of input");
+		}
+		if(!y){
+			lval_delete(x);
+			*err = r.err;
+			return NULL;
+		}
+		lval_add(x, y);
+	}
 	return x;
 }
 
@@ -162,7 +1010,7 @@ void lval_expr_print(lval* v, char open, char close){
 	for(int i =0; i < v->count; i++){
 
 		//print the value contained within
-		lval_print(v->cell[i]);
+		lval_print(LPTR(v->cell[i]));
 
 		//print space unless we're on the last element
 		if(i != (v->count-1)){
@@ -177,8 +1025,19 @@ void lval_print(lval* v){
 		case LVAL_NUM:   printf("%li", v->num); break;
 		case LVAL_ERR:   printf("Error: %s", v->err); break;
 		case LVAL_SYM:   printf("%s", v->sym); break;
-		case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
-		case LVAL_QEXPR: lval_expr_print(v, '{', '}'); break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			//an inlined call prints as the call it replaced
+			if(lval_is_inline(v)){
+				lval_expr_print(LPTR(v->cell[5]), v->type == LVAL_SEXPR ? '(' : '{',
+					v->type == LVAL_SEXPR ? ')' : '}');
+			} else if(v->type == LVAL_SEXPR){
+				lval_expr_print(v, '(', ')');
+			} else {
+				lval_expr_print(v, '{', '}');
+			}
+		break;
+		case LVAL_RECUR: printf("<recur>"); break;
 		case LVAL_FUN:   
 			if(v->builtin){
 				printf("<builtin>");
@@ -199,34 +1058,37 @@ void lval_delete(lval* v){
 		case LVAL_NUM: break;
 		case LVAL_FUN: 
 			if(!v->builtin){
+				if(v->region) { lregion_owners[v->count] = NULL; }
 				lenv_del(v->env);
 				lval_delete(v->formals);
 				lval_delete(v->body);
+				lcode_release(v->code);
 			}
 		break;
 
-		//for symbols and errors, free the strings
-		case LVAL_ERR: free(v->err); break;
-		case LVAL_SYM: free(v->sym); break;
+		//for errors, free the string. Symbols are interned
+		case LVAL_ERR:
+			if(v->region) { lregion_owners[v->count] = NULL; }
+			free(v->err);
+		break;
+		case LVAL_SYM: break;
 
 		//if sexpr or qexpr, delete all elements inside it
 		case LVAL_QEXPR:
 		case LVAL_SEXPR: 
-		  for(int i = 0; i < v->count; i++){
-		  	lval_delete(v->cell[i]);
-		  }
-		  //also free memory allocated to contain the pointers
-		  free(v->cell);
+		case LVAL_RECUR:
+		  //the elements go with the last reference to the cells
+		  lcell_release(v);
 		break;
 	}
 
 	//free the struct
-	free(v);
+	lval_free(v);
 }
 
 lval* lval_copy(lval* v){
 	
-	lval* x = malloc(sizeof(lval));
+	lval* x = lval_alloc();
 	x->type = v->type;
 
 	switch(v->type){
@@ -240,6 +1102,9 @@ lval* lval_copy(lval* v){
 				x->env = lenv_copy(v->env);
 				x->formals = lval_copy(v->formals);
 				x->body = lval_copy(v->body);
+				x->code = v->code;
+				x->code->refs++;
+				lregion_own(x);
 			}
 		break;
 		case LVAL_NUM: x->num = v->num; break;
@@ -248,30 +1113,54 @@ lval* lval_copy(lval* v){
 		case LVAL_ERR:
 			x->err = malloc(strlen(v->err) + 1);
 			strcpy(x->err, v->err);
+			lregion_own(x);
 		break;
 
-		case LVAL_SYM:
-			x->sym = malloc(strlen(v->sym) + 1);
-		strcpy(x->sym, v->sym);
-		break;
+		case LVAL_SYM: x->sym = v->sym; break;
 
-		//copy lists by copying each sub expression
+		//lists share their cells, except that heap lists cannot point
+		//into the region, so those copy each sub expression
 		case LVAL_SEXPR:
 		case LVAL_QEXPR:
+		case LVAL_RECUR:
+			x->num = v->num;
 			x->count = v->count;
-			x->cell = malloc(sizeof(lval*) * x->count);
-			for(int i = 0; i < x->count; i++){
-				x->cell[i] = lval_copy(v->cell[i]);
+			x->cell = NULL;
+			x->cells = NULL;
+			if(!x->count) { break; }
+			if(v->cells->region && !x->region){
+				x->cells = lcell_alloc(x->count, 0);
+				x->cell = x->cells->cell;
+				for(int i = 0; i < x->count; i++){
+					x->cell[i] = LREF(lval_copy(LPTR(v->cell[i])));
+				}
+				break;
+			}
+			if(v->cell == v->cells->cell) { v->cells->count = v->count; }
+			if(x->region && !v->cells->region){
+				lregion_pin(v->cells);
+			} else {
+				v->cells->refs++;
 			}
+			x->cells = v->cells;
+			x->cell = v->cell;
 		break;
 	}
 	return x;
 }
 
+//copy a value onto the heap, for storage that outlives the open region
+lval* lval_promote(lval* v){
+	lregion_heap++;
+	lval* x = lval_copy(v);
+	lregion_heap--;
+	return x;
+}
+
 void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
 lval* lval_fun(lbuiltin func){
-	lval* v = malloc(sizeof(lval));
+	lval* v = lval_alloc();
 	v->type = LVAL_FUN;
 	v->builtin = func;
 	return v;
@@ -280,7 +1169,7 @@ lval* lval_fun(lbuiltin func){
 lval* builtin_op(lenv* e, lval* a, char* op){
 	//ensure all arguments are numbers
 	for(int i = 0; i < a->count; i++){
-		if(a->cell[i]->type != LVAL_NUM){
+		if(LPTR(a->cell[i])->type != LVAL_NUM){
 			lval_delete(a);
 			return lval_err("Cannot operate on non-number.");
 		}
@@ -330,23 +1219,59 @@ lval* builtin_op(lenv* e, lval* a, char* op){
 }
 
 lval* lval_join(lval* x, lval* y){
-	//for each cell in y add it to x
-	while(y->count){
-		x = lval_add(x, lval_pop(y, 0));
+	if(!y->count){
+		lval_delete(y);
+		return x;
+	}
+
+	//grow x once to fit y
+	lval_own(x);
+	if(!x->cells || x->count + y->count > x->cells->cap){
+		lcells* b = lcell_alloc(x->count + y->count, x->region);
+		if(x->count) { memcpy(b->cell, x->cell, sizeof(lref) * x->count); }
+		if(x->cells) { lcell_free(x->cells); }
+		x->cells = b;
+		x->cell = b->cell;
+	}
+
+	//move y's cells across as a block, or copy them if y shares them
+	if(lval_owned(y)){
+		memcpy(x->cell + x->count, y->cell, sizeof(lref) * y->count);
+		x->count += y->count;
+		y->count = 0;
+	} else {
+		for(int i = 0; i < y->count; i++){
+			x->cell[x->count++] = LREF(lval_copy(LPTR(y->cell[i])));
+		}
 	}
 
-	//delete empty y and return x
+	//delete what is left of y and return x
 	lval_delete(y);
 	return x;
 }
 
+//apply f to the arguments a. Both are consumed: f is always a private
+//copy taken from the environment, so its bindings and body are reused
+//in place rather than copied again
 lval* lval_call(lenv* e, lval* f, lval* a){
 
 	//if builtin then simply apply it
 	if(f->builtin) {
-		return f->builtin(e, a);
+		lbuiltin fn = f->builtin;
+		lval_delete(f);
+		return fn(e, a);
+	}
+	//full applications may run as native code once the lambda is hot
+	if(f->env->count == 0 && a->count == f->formals->count){
+		lval* r = lcode_call(e, f, a);
+		if(r) { lval_delete(f); return r; }
 	}
+	return lval_apply(e, f, a);
+}
 
+//bind the arguments of a lambda and evaluate its body, or return it
+//partially applied
+lval* lval_apply(lenv* e, lval* f, lval* a){
 	//record argument counts
 	int given = a->count;
 	int total = f->formals->count;
@@ -355,6 +1280,7 @@ lval* lval_call(lenv* e, lval* f, lval* a){
 	while(a->count){
 		//if we've run out of formal arguments to bind
 		if(f->formals->count == 0){
+			lval_delete(f);
 			lval_delete(a);
 			return lval_err(
 				"Function passed too many arguments. "
@@ -367,12 +1293,9 @@ lval* lval_call(lenv* e, lval* f, lval* a){
 		//pop the next argument from the list
 		lval* val = lval_pop(a, 0);
 
-		//bind a copy into the function's environment
-		lenv_put(f->env, sym, val);
-
-		//delete the symbol and value
+		//move the value into the function's environment
+		lenv_move(f->env, sym, val);
 		lval_delete(sym);
-		lval_delete(val);
 	}
 
 	//argument list is now bound and can be cleaned up
@@ -384,11 +1307,15 @@ lval* lval_call(lenv* e, lval* f, lval* a){
 		//set environment parent to evaluation environment
 		f->env->par = e;
 
-		//evaluate and return
-		return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+		//evaluate the body in place, then release the function
+		lval* body = f->body;
+		f->body = lval_qexpr();
+		lval* x = builtin_eval(f->env, lval_add(lval_sexpr(), body));
+		lval_delete(f);
+		return x;
 	} else {
-		//otherwise return partially evaluated function
-		return lval_copy(f);
+		//otherwise return the partially evaluated function itself
+		return f;
 	}
 }
 
@@ -399,22 +1326,22 @@ lval* builtin_head(lenv* e, lval* a){
 		"Got %i, Expected %i.",
 		a->count, 1);
 
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+	LASSERT(a, LPTR(a->cell[0])->type == LVAL_QEXPR,
 		"Function 'head' passed incorrect type. "
 		"Got %s, Expected %s",
-		ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+		ltype_name(LPTR(a->cell[0])->type), ltype_name(LVAL_QEXPR));
  	
- 	LASSERT(a, a->cell[0]->count != 0, 
+ 	LASSERT(a, LPTR(a->cell[0])->count != 0, 
  		"Function 'head' was passed {}");
 	
 	//otherwise take first argument
 	lval* v = lval_take(a, 0);
 
-	//delete all elements that are not head and return
-	while(v->count > 1) {
-		lval_delete(lval_pop(v, 1));
-	}
-	return v;
+	//keep the first element, copying it only if the cells are shared,
+	//and delete the rest
+	lval* x = lval_owned(v) ? lval_pop(v, 0) : lval_copy(LPTR(v->cell[0]));
+	lval_delete(v);
+	return lval_add(lval_qexpr(), x);
 }
 
 lval* builtin_tail(lenv* e, lval* a){
@@ -424,19 +1351,25 @@ lval* builtin_tail(lenv* e, lval* a){
 		"Got %i, Expected %i.",
 		a->count, 1);
 	
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR, 
+	LASSERT(a, LPTR(a->cell[0])->type == LVAL_QEXPR, 
 		"Function 'tail' passed incorrect type. "
 		"Got %s, Expected %s",
-		ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+		ltype_name(LPTR(a->cell[0])->type), ltype_name(LVAL_QEXPR));
 	
-	LASSERT(a, a->cell[0]->count != 0,
+	LASSERT(a, LPTR(a->cell[0])->count != 0,
 		"Function 'tail' was passed {}");
 	
 	//take first argument
 	lval* v = lval_take(a, 0);
 
-	//delete first element and return
-	lval_delete(lval_pop(v, 0));
+	//delete first element and return. Shared cells are not copied, the
+	//list just views them from the second element on
+	if(lval_owned(v)){
+		lval_delete(lval_pop(v, 0));
+	} else {
+		v->cell++;
+		v->count--;
+	}
 	return v;
 }
 
@@ -451,20 +1384,20 @@ lval* builtin_eval(lenv* e, lval* a){
 		"Got %i, Expected %i.",
 		a->count, 1);
 
-	LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+	LASSERT(a, LPTR(a->cell[0])->type == LVAL_QEXPR,
 		"Function 'eval' passed incorrect type. "
 		"Got %s, Expected %s",
-		ltype_name(a->cell[0]->type), ltype_name(LVAL_QEXPR));
+		ltype_name(LPTR(a->cell[0])->type), ltype_name(LVAL_QEXPR));
 
 	lval* x = lval_take(a, 0);
 	x->type = LVAL_SEXPR;
-	return lval_eval(e, x);
+	return lval_eval(e, lval_expand_in(e, x));
 }
 
 lval* builtin_join(lenv* e, lval* a){
 	//ensure all args are q expressions
 	for(int i = 0; i < a->count; i++){
-		LASSERT(a, a->cell[i]->type == LVAL_QEXPR,
+		LASSERT(a, LPTR(a->cell[i])->type == LVAL_QEXPR,
 			"Function 'join' passed incorrect type");
 	}
 
@@ -494,6 +1427,80 @@ lval* builtin_div(lenv* e, lval* a){
 	return builtin_op(e, a, "/");
 }
 
+lval* builtin_ord(lenv* e, lval* a, char* op){
+	LASSERT_NUM(op, a, 2);
+	LASSERT_TYPE(op, a, 0, LVAL_NUM);
+	LASSERT_TYPE(op, a, 1, LVAL_NUM);
+
+	int r = 0;
+	if(strcmp(op, ">") == 0)  { r = (LPTR(a->cell[0])->num >  LPTR(a->cell[1])->num); }
+	if(strcmp(op, "<") == 0)  { r = (LPTR(a->cell[0])->num <  LPTR(a->cell[1])->num); }
+	if(strcmp(op, ">=") == 0) { r = (LPTR(a->cell[0])->num >= LPTR(a->cell[1])->num); }
+	if(strcmp(op, "<=") == 0) { r = (LPTR(a->cell[0])->num <= LPTR(a->cell[1])->num); }
+	lval_delete(a);
+	return lval_num(r);
+}
+
+lval* builtin_gt(lenv* e, lval* a) { return builtin_ord(e, a, ">"); }
+lval* builtin_lt(lenv* e, lval* a) { return builtin_ord(e, a, "<"); }
+lval* builtin_ge(lenv* e, lval* a) { return builtin_ord(e, a, ">="); }
+lval* builtin_le(lenv* e, lval* a) { return builtin_ord(e, a, "<="); }
+
+int lval_eq(lval* x, lval* y){
+	if(x->type != y->type) { return 0; }
+
+	switch(x->type){
+		case LVAL_NUM: return x->num == y->num;
+		case LVAL_ERR: return strcmp(x->err, y->err) == 0;
+		case LVAL_SYM: return x->sym == y->sym;
+		case LVAL_FUN:
+			if(x->builtin || y->builtin){
+				return x->builtin == y->builtin;
+			}
+			return lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body);
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+		case LVAL_RECUR:
+			//an inlined call compares as the call it replaced, as it prints
+			if(lval_is_inline(x)) { x = LPTR(x->cell[5]); }
+			if(lval_is_inline(y)) { y = LPTR(y->cell[5]); }
+			if(x->count != y->count) { return 0; }
+			//views of the same cells
+			if(x->cell == y->cell) { return 1; }
+			//hash-consed lists are equal only if they share storage
+			if(lval_consed(x) && lval_consed(y)) { return 0; }
+			for(int i = 0; i < x->count; i++){
+				if(!lval_eq(LPTR(x->cell[i]), LPTR(y->cell[i]))) { return 0; }
+			}
+			return 1;
+	}
+	return 0;
+}
+
+lval* builtin_cmp(lenv* e, lval* a, char* op){
+	LASSERT_NUM(op, a, 2);
+	int r = lval_eq(LPTR(a->cell[0]), LPTR(a->cell[1]));
+	if(strcmp(op, "!=") == 0) { r = !r; }
+	lval_delete(a);
+	return lval_num(r);
+}
+
+lval* builtin_eq(lenv* e, lval* a) { return builtin_cmp(e, a, "=="); }
+lval* builtin_ne(lenv* e, lval* a) { return builtin_cmp(e, a, "!="); }
+
+lval* builtin_if(lenv* e, lval* a){
+	LASSERT_NUM("if", a, 3);
+	LASSERT_TYPE("if", a, 0, LVAL_NUM);
+	LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
+	LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+
+	//evaluate the chosen branch as an s-expression
+	lval* x = lval_pop(a, LPTR(a->cell[0])->num ? 1 : 2);
+	x->type = LVAL_SEXPR;
+	lval_delete(a);
+	return lval_eval(e, x);
+}
+
 lval* builtin_lambda(lenv* e, lval* a){
 	//check two arguments, each of which are q-expressions
 	LASSERT_NUM("\\", a, 2);
@@ -501,10 +1508,10 @@ lval* builtin_lambda(lenv* e, lval* a){
 	LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
 
 	//check that first q-expression contains only symbols
-	for(int i = 0; i < a->cell[0]->count; i++){
-		LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+	for(int i = 0; i < LPTR(a->cell[0])->count; i++){
+		LASSERT(a, (LPTR(LPTR(a->cell[0])->cell[i])->type == LVAL_SYM),
 			"Cannot define non-symbol. Got %s, expected %s.",
-			ltype_name(a->cell[0]->cell[i]->type), ltype_name(LVAL_SYM));
+			ltype_name(LPTR(LPTR(a->cell[0])->cell[i])->type), ltype_name(LVAL_SYM));
 	}
 
 	//pop the first two arguments and pass them to lval_lambda
@@ -526,12 +1533,12 @@ lval* builtin_put(lenv* e, lval* a){
 lval* builtin_var(lenv* e, lval* a, char* func){
 	LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
-	lval* syms = a->cell[0];
+	lval* syms = LPTR(a->cell[0]);
 	for(int i = 0; i < syms->count; i++){
-		LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+		LASSERT(a, (LPTR(syms->cell[i])->type == LVAL_SYM),
 			"Function '%s' cannot define non-symbol. "
 			"Got %s, Expected %s", func,
-			ltype_name(syms->cell[i]->type),
+			ltype_name(LPTR(syms->cell[i])->type),
 			ltype_name(LVAL_SYM));
 	}
 
@@ -539,31 +1546,2198 @@ lval* builtin_var(lenv* e, lval* a, char* func){
 		"Function '%s' passed too many arguments for symbols. "
 		"Got %i, Expected %i.", func, syms->count, a->count-1);
 
+	lval_own(a);
 	for(int i=0; i < syms->count; i++){
-		//if 'def' define globally, if 'put' define locally
-		if(strcmp(func, "def") == 0){
-			lenv_def(e, syms->cell[i], a->cell[i+1]);
+		//name lambdas after the first symbol they are bound to
+		lval* v = LPTR(a->cell[i+1]);
+		if(v->type == LVAL_FUN && !v->builtin && !v->code->name){
+			v->code->name = LPTR(syms->cell[i])->sym;
 		}
 
-		if(strcmp(func, "=") == 0){
-			lenv_put(e, syms->cell[i], a->cell[i+1]);
+		//if 'def' define globally, if 'put' define locally. The
+		//values are moved out of the argument list
+		if(strcmp(func, "def") == 0){
+			lenv_def_move(e, LPTR(syms->cell[i]), v);
+		} else {
+			lenv_move(e, LPTR(syms->cell[i]), v);
 		}
 	}
 
+	//only the symbol list is left for a to own
+	a->count = 1;
 	lval_delete(a);
 	return lval_sexpr();
 }
 
+//recur's value only means something returned straight from a loop body.
+//Passed on as an argument or a binding, or dropped as a form that is not
+//the last, it is an error
+lval* lval_recur_check(lval* x){
+	if(x->type != LVAL_RECUR) { return x; }
+	lval_delete(x);
+	return lval_err("Function 'recur' used outside of tail position.");
+}
+
+//evaluate the body forms of a special form in order, returning the last
+lval* lval_eval_body(lenv* e, lval* a, int first){
+	lval* x = lval_sexpr();
+	while(a->count > first){
+		lval_delete(x);
+		x = lval_eval(e, lval_pop(a, first));
+		if(a->count > first) { x = lval_recur_check(x); }
+		if(x->type == LVAL_ERR) { break; }
+	}
+	lval_delete(a);
+	return x;
+}
+
+//let, let* and letrec. Bindings live in a frame on the C stack which is
+//linked in front of e for the body and released as soon as it returns
+lval* builtin_let_form(lenv* e, lval* a, char* form){
+	LASSERT(a, a->count >= 3,
+		"Function '%s' passed too few arguments. "
+		"Got %i, Expected at least %i.", form, a->count - 1, 2);
+	LASSERT(a, LPTR(a->cell[1])->type == LVAL_QEXPR || LPTR(a->cell[1])->type == LVAL_SEXPR,
+		"Function '%s' passed incorrect type for bindings. "
+		"Got %s, Expected %s.", form,
+		ltype_name(LPTR(a->cell[1])->type), ltype_name(LVAL_QEXPR));
+
+	//the initial values are popped out of the bindings
+	lval* binds = LPTR(a->cell[1]);
+	lval_own(binds);
+	for(int i = 0; i < binds->count; i++){
+		lval* b = LPTR(binds->cell[i]);
+		LASSERT(a, (b->type == LVAL_QEXPR || b->type == LVAL_SEXPR) && b->count == 2
+			&& LPTR(b->cell[0])->type == LVAL_SYM,
+			"Function '%s' binding %i is not a {symbol value} pair.", form, i);
+	}
+
+	int n = binds->count;
+	int seq = strcmp(form, "let*") == 0;
+	int rec = strcmp(form, "letrec") == 0;
+
+	//names are borrowed from the binding list, which outlives the frame
+	char* syms[n + 1];
+	lref vals[n + 1];
+	lenv frame = { e, 0, LENV_LET, syms, vals };
+
+	//a name bound twice has one slot, holding the last value given to it
+	if(rec){
+		for(int i = 0; i < n; i++){
+			char* sym = LPTR(LPTR(binds->cell[i])->cell[0])->sym;
+			if(lenv_lookup_frame(&frame, sym)) { continue; }
+			syms[frame.count] = sym;
+			vals[frame.count++] = LREF(lval_sexpr());
+		}
+	}
+
+	for(int i = 0; i < n; i++){
+		lval* init = lval_pop(LPTR(binds->cell[i]), 1);
+		lval* x = lval_recur_check(lval_eval(seq || rec ? &frame : e, init));
+		if(x->type == LVAL_ERR){
+			lenv_frame_release(&frame);
+			lval_delete(a);
+			return x;
+		}
+
+		//fill the next slot directly unless the frame was spilled by '='
+		//or already binds the name
+		lval* k = LPTR(LPTR(binds->cell[i])->cell[0]);
+		if(frame.frame == LENV_LET && !rec && !lenv_lookup_frame(&frame, k->sym)){
+			syms[frame.count] = k->sym;
+			vals[frame.count++] = LREF(x);
+		} else {
+			lenv_move(&frame, k, x);
+		}
+	}
+
+	lval* x = lval_eval_body(&frame, a, 2);
+	lenv_frame_release(&frame);
+	return x;
+}
+
+lval* builtin_let(lenv* e, lval* a)      { return builtin_let_form(e, a, "let"); }
+lval* builtin_let_star(lenv* e, lval* a) { return builtin_let_form(e, a, "let*"); }
+lval* builtin_letrec(lenv* e, lval* a)   { return builtin_let_form(e, a, "letrec"); }
+
+//evaluate copies of the body forms of a loop, leaving the originals
+//in place for the next iteration
+lval* lval_eval_copies(lenv* e, lval* a, int first){
+	lval* x = lval_sexpr();
+	for(int i = first; i < a->count; i++){
+		lval_delete(x);
+		x = lval_eval(e, lval_copy(LPTR(a->cell[i])));
+		if(i < a->count - 1) { x = lval_recur_check(x); }
+		if(x->type == LVAL_ERR) { break; }
+	}
+	return x;
+}
+
+//number of loops currently running, so recur can check it has a target
+static int lval_loop_depth = 0;
+
+lval* builtin_while(lenv* e, lval* a){
+	LASSERT(a, a->count >= 2,
+		"Function 'while' passed too few arguments. "
+		"Got %i, Expected at least %i.", a->count - 1, 1);
+
+	while(1){
+		lval* c = lval_eval(e, lval_copy(LPTR(a->cell[1])));
+		if(c->type == LVAL_ERR){
+			lval_delete(a);
+			return c;
+		}
+		if(c->type != LVAL_NUM){
+			lval* err = lval_err("Function 'while' passed incorrect type for condition. "
+				"Got %s, Expected %s.", ltype_name(c->type), ltype_name(LVAL_NUM));
+			lval_delete(c);
+			lval_delete(a);
+			return err;
+		}
+		long go = c->num;
+		lval_delete(c);
+		if(!go) { break; }
+
+		lval* x = lval_recur_check(lval_eval_copies(e, a, 2));
+		if(x->type == LVAL_ERR){
+			lval_delete(a);
+			return x;
+		}
+		lval_delete(x);
+	}
+
+	lval_delete(a);
+	return lval_sexpr();
+}
+
+//dotimes {i n} body. The counter lives in a one slot loop frame and is
+//updated in place each iteration
+lval* builtin_dotimes(lenv* e, lval* a){
+	LASSERT(a, a->count >= 2,
+		"Function 'dotimes' passed too few arguments. "
+		"Got %i, Expected at least %i.", a->count - 1, 1);
+	LASSERT(a, (LPTR(a->cell[1])->type == LVAL_QEXPR || LPTR(a->cell[1])->type == LVAL_SEXPR)
+		&& LPTR(a->cell[1])->count == 2 && LPTR(LPTR(a->cell[1])->cell[0])->type == LVAL_SYM,
+		"Function 'dotimes' expects a {symbol count} pair.");
+
+	lval* n = lval_eval(e, lval_pop(LPTR(a->cell[1]), 1));
+	if(n->type != LVAL_NUM){
+		lval* err = n->type == LVAL_ERR ? n :
+			lval_err("Function 'dotimes' passed incorrect type for count. "
+				"Got %s, Expected %s.", ltype_name(n->type), ltype_name(LVAL_NUM));
+		if(err != n) { lval_delete(n); }
+		lval_delete(a);
+		return err;
+	}
+
+	char* syms[1] = { LPTR(LPTR(a->cell[1])->cell[0])->sym };
+	lref vals[1] = { LREF(lval_num(0)) };
+	lenv frame = { e, 1, LENV_LOOP, syms, vals };
+
+	for(long i = 0; i < n->num; i++){
+		//the body may have rebound the counter with '='
+		if(LPTR(vals[0])->type != LVAL_NUM){
+			lval_delete(LPTR(vals[0]));
+			vals[0] = LREF(lval_num(0));
+		}
+		LPTR(vals[0])->num = i;
+
+		lval* x = lval_recur_check(lval_eval_copies(&frame, a, 2));
+		if(x->type == LVAL_ERR){
+			lenv_frame_release(&frame);
+			lval_delete(n);
+			lval_delete(a);
+			return x;
+		}
+		lval_delete(x);
+	}
+
+	lenv_frame_release(&frame);
+	lval_delete(n);
+	lval_delete(a);
+	return lval_sexpr();
+}
+
+//loop {{name init} ...} body. When the body returns (recur ...) the new
+//values are moved straight into the frame slots and the body runs again
+lval* builtin_loop(lenv* e, lval* a){
+	LASSERT(a, a->count >= 3,
+		"Function 'loop' passed too few arguments. "
+		"Got %i, Expected at least %i.", a->count - 1, 2);
+	LASSERT(a, LPTR(a->cell[1])->type == LVAL_QEXPR || LPTR(a->cell[1])->type == LVAL_SEXPR,
+		"Function 'loop' passed incorrect type for bindings. "
+		"Got %s, Expected %s.",
+		ltype_name(LPTR(a->cell[1])->type), ltype_name(LVAL_QEXPR));
+
+	lval* binds = LPTR(a->cell[1]);
+	lval_own(binds);
+	for(int i = 0; i < binds->count; i++){
+		lval* b = LPTR(binds->cell[i]);
+		LASSERT(a, (b->type == LVAL_QEXPR || b->type == LVAL_SEXPR) && b->count == 2
+			&& LPTR(b->cell[0])->type == LVAL_SYM,
+			"Function 'loop' binding %i is not a {symbol value} pair.", i);
+	}
+
+	int n = binds->count;
+	char* syms[n + 1];
+	lref vals[n + 1];
+	lenv frame = { e, 0, LENV_LOOP, syms, vals };
+
+	//initial values see the earlier bindings, as in let*
+	for(int i = 0; i < n; i++){
+		lval* x = lval_recur_check(lval_eval(&frame, lval_pop(LPTR(binds->cell[i]), 1)));
+		if(x->type == LVAL_ERR){
+			lenv_frame_release(&frame);
+			lval_delete(a);
+			return x;
+		}
+		syms[i] = LPTR(LPTR(binds->cell[i])->cell[0])->sym;
+		vals[i] = LREF(x);
+		frame.count++;
+	}
+
+	lval_loop_depth++;
+	lval* x;
+	while(1){
+		x = lval_eval_copies(&frame, a, 2);
+		if(x->type != LVAL_RECUR) { break; }
+
+		if(x->count != n){
+			lval* err = lval_err("Function 'recur' passed incorrect number of arguments. "
+				"Got %i, Expected %i.", x->count, n);
+			lval_delete(x);
+			x = err;
+			break;
+		}
+		lval_own(x);
+		for(int i = 0; i < n; i++){
+			lval_delete(LPTR(vals[i]));
+			vals[i] = x->cell[i];
+		}
+		x->count = 0;
+		lval_delete(x);
+	}
+	lval_loop_depth--;
+
+	lenv_frame_release(&frame);
+	lval_delete(a);
+	return x;
+}
+
+lval* builtin_recur(lenv* e, lval* a){
+	LASSERT(a, lval_loop_depth > 0, "Function 'recur' used outside of loop.");
+	a->type = LVAL_RECUR;
+	return a;
+}
+
+//special forms, whose arguments are passed unevaluated. The names are
+//interned by lenv_add_builtins so lookup is a pointer compare
+struct { char* name; lbuiltin form; } lspecials[] = {
+	{ "let", builtin_let },
+	{ "let*", builtin_let_star },
+	{ "letrec", builtin_letrec },
+	{ "while", builtin_while },
+	{ "dotimes", builtin_dotimes },
+	{ "loop", builtin_loop },
+	{ "inline#", builtin_inline },
+	{ NULL, NULL }
+};
+
+lbuiltin lval_special(lval* v){
+	for(int i = 0; lspecials[i].name; i++){
+		if(LPTR(v->cell[0])->sym == lspecials[i].name) { return lspecials[i].form; }
+	}
+	return NULL;
+}
+
+//structural hash, consistent with lval_eq
+unsigned long lval_hash(lval* v){
+	unsigned long h = v->type;
+	switch(v->type){
+		case LVAL_NUM: return h * 31 + (unsigned long)v->num;
+		case LVAL_SYM: return h * 31 + (unsigned long)v->sym;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			for(int i = 0; i < v->count; i++){
+				h = h * 31 + lval_hash(LPTR(v->cell[i]));
+			}
+			return h;
+	}
+	return h;
+}
+
+//macros are expanded once, by lval_expand, before a form is evaluated
+typedef struct {
+	char* name;
+	lval* params;
+	lval* body;
+} lmacro;
+
+static lmacro* lmacros = NULL;
+static int lmacro_count = 0;
+
+//expansion cache, keyed on the whole call form
+#define LMACRO_CACHE_SIZE 4096
+
+typedef struct {
+	unsigned long hash;
+	lval* form;
+	lval* expansion;
+} lmacro_cached;
+
+static lmacro_cached lmacro_cache[LMACRO_CACHE_SIZE];
+
+//counter for the fresh names given to variables a macro binds
+static int lmacro_gensym = 0;
+
+//nesting of expansions, to stop macros that expand forever
+static int lmacro_depth = 0;
+
+void lmacro_cache_flush(void){
+	for(int i = 0; i < LMACRO_CACHE_SIZE; i++){
+		if(lmacro_cache[i].form){
+			lval_delete(lmacro_cache[i].form);
+			lval_delete(lmacro_cache[i].expansion);
+			lmacro_cache[i].form = NULL;
+		}
+	}
+}
+
+lmacro* lmacro_find(char* name){
+	for(int i = 0; i < lmacro_count; i++){
+		if(lmacros[i].name == name) { return &lmacros[i]; }
+	}
+	return NULL;
+}
+
+//names of macros shadowed by a variable around the form being expanded,
+//where a call by that name is an ordinary call
+static char** lmacro_shadow = NULL;
+static int lmacro_shadow_count = 0;
+static int lmacro_shadow_cap = 0;
+
+//shadow the macro of that name, if there is one
+void lmacro_shadow_sym(char* sym){
+	if(!lmacro_find(sym)) { return; }
+	if(lmacro_shadow_count == lmacro_shadow_cap){
+		lmacro_shadow_cap = lmacro_shadow_cap ? lmacro_shadow_cap * 2 : 8;
+		lmacro_shadow = realloc(lmacro_shadow, sizeof(char*) * lmacro_shadow_cap);
+	}
+	lmacro_shadow[lmacro_shadow_count++] = sym;
+}
+
+//shadow the macro a binder names
+void lmacro_bind(lval* k){
+	if(k->type == LVAL_SYM) { lmacro_shadow_sym(k->sym); }
+}
+
+//the macro a form calls, unless its name is shadowed
+lmacro* lmacro_call(lval* v){
+	if(v->count == 0 || LPTR(v->cell[0])->type != LVAL_SYM) { return NULL; }
+	char* name = LPTR(v->cell[0])->sym;
+	for(int i = 0; i < lmacro_shadow_count; i++){
+		if(lmacro_shadow[i] == name) { return NULL; }
+	}
+	return lmacro_find(name);
+}
+
+lval* builtin_defmacro(lval* a){
+	LASSERT(a, a->count == 3,
+		"Function 'defmacro' passed incorrect number of arguments. "
+		"Got %i, Expected %i.", a->count - 1, 2);
+	LASSERT_TYPE("defmacro", a, 1, LVAL_QEXPR);
+	LASSERT_TYPE("defmacro", a, 2, LVAL_QEXPR);
+	LASSERT(a, LPTR(a->cell[1])->count > 0,
+		"Function 'defmacro' passed {} for argument %i.", 1);
+	for(int i = 0; i < LPTR(a->cell[1])->count; i++){
+		LASSERT(a, LPTR(LPTR(a->cell[1])->cell[i])->type == LVAL_SYM,
+			"Cannot define non-symbol. Got %s, expected %s.",
+			ltype_name(LPTR(LPTR(a->cell[1])->cell[i])->type), ltype_name(LVAL_SYM));
+	}
+
+	lval* params = lval_pop(a, 1);
+	lval* body = lval_pop(a, 1);
+	lval* k = lval_pop(params, 0);
+	char* name = k->sym;
+	lval_delete(k);
+	lval_delete(a);
+
+	lmacro* m = lmacro_find(name);
+	if(m){
+		lval_delete(m->params);
+		lval_delete(m->body);
+	} else {
+		lmacros = realloc(lmacros, sizeof(lmacro) * (lmacro_count + 1));
+		m = &lmacros[lmacro_count++];
+		m->name = name;
+	}
+	m->params = lval_promote(params);
+	m->body = lval_promote(body);
+	lval_delete(params);
+	lval_delete(body);
+
+	//cached expansions may have used the old definition
+	lmacro_cache_flush();
+	return lval_sexpr();
+}
+
+int lval_find_sym(lval* v, char* sym){
+	for(int i = 0; i < v->count; i++){
+		if(LPTR(v->cell[i])->type == LVAL_SYM && LPTR(v->cell[i])->sym == sym) { return i; }
+	}
+	return -1;
+}
+
+//collect the names a template binds through lambdas and the let and
+//loop forms, leaving out the macro parameters
+void lmacro_binders(lval* t, lval* params, lval* out){
+	if(t->type != LVAL_SEXPR && t->type != LVAL_QEXPR) { return; }
+
+	if(t->count > 1 && LPTR(t->cell[0])->type == LVAL_SYM
+		&& (LPTR(t->cell[1])->type == LVAL_QEXPR || LPTR(t->cell[1])->type == LVAL_SEXPR)){
+		char* head = LPTR(t->cell[0])->sym;
+		lval* b = LPTR(t->cell[1]);
+		lval* names = lval_qexpr();
+		if(head == lsym_intern("\\")){
+			for(int i = 0; i < b->count; i++){ lval_add(names, lval_copy(LPTR(b->cell[i]))); }
+		} else if(head == lsym_intern("dotimes")){
+			if(b->count > 0) { lval_add(names, lval_copy(LPTR(b->cell[0]))); }
+		} else if(lval_special(t) && head != lsym_intern("while")){
+			for(int i = 0; i < b->count; i++){
+				if(LPTR(b->cell[i])->count > 0) { lval_add(names, lval_copy(LPTR(LPTR(b->cell[i])->cell[0]))); }
+			}
+		}
+		for(int i = 0; i < names->count; i++){
+			lval* n = LPTR(names->cell[i]);
+			if(n->type == LVAL_SYM && lval_find_sym(params, n->sym) < 0
+				&& lval_find_sym(out, n->sym) < 0){
+				lval_add(out, lval_copy(n));
+			}
+		}
+		lval_delete(names);
+	}
+
+	for(int i = 0; i < t->count; i++){
+		lmacro_binders(LPTR(t->cell[i]), params, out);
+	}
+}
+
+//rename the template's own binders and substitute the call arguments.
+//Arguments are spliced in after renaming, so the variables the template
+//binds can't capture the caller's. Other names in the template are not
+//renamed and, like any code under dynamic scope, are looked up where the
+//expansion runs, so a caller binding + changes what + means in it
+lval* lmacro_subst(lval* t, lval* params, lval* args, lval* binders, lval* fresh){
+	if(t->type == LVAL_SYM){
+		int i = lval_find_sym(params, t->sym);
+		if(i >= 0) { return lval_copy(LPTR(args->cell[i])); }
+		i = lval_find_sym(binders, t->sym);
+		if(i >= 0) { return lval_copy(LPTR(fresh->cell[i])); }
+		return lval_copy(t);
+	}
+	if(t->type != LVAL_SEXPR && t->type != LVAL_QEXPR) { return lval_copy(t); }
+
+	lval* x = t->type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+	for(int i = 0; i < t->count; i++){
+		lval_add(x, lmacro_subst(LPTR(t->cell[i]), params, args, binders, fresh));
+	}
+	return x;
+}
+
+lval* lval_expand(lval* v);
+
+lval* lmacro_expand(lmacro* m, lval* v){
+	//an expansion under shadowed macros is not cached, as the same call
+	//form expands differently elsewhere
+	int cache = lmacro_shadow_count == 0;
+	unsigned long h = lval_hash(v);
+	lmacro_cached* c = &lmacro_cache[h % LMACRO_CACHE_SIZE];
+	if(cache && c->form && c->hash == h && lval_eq(c->form, v)){
+		lval_delete(v);
+		return lval_copy(c->expansion);
+	}
+
+	if(v->count - 1 != m->params->count){
+		lval* err = lval_err("Macro '%s' passed incorrect number of arguments. "
+			"Got %i, Expected %i.", m->name, v->count - 1, m->params->count);
+		lval_delete(v);
+		return err;
+	}
+	if(lmacro_depth > 1000){
+		lval_delete(v);
+		return lval_err("Macro '%s' expanded too deeply.", m->name);
+	}
+
+	lval* binders = lval_qexpr();
+	lval* fresh = lval_qexpr();
+	lmacro_binders(m->body, m->params, binders);
+	for(int i = 0; i < binders->count; i++){
+		char name[512];
+		snprintf(name, sizeof(name), "%s#%i", LPTR(binders->cell[i])->sym, ++lmacro_gensym);
+		lval_add(fresh, lval_sym(name));
+	}
+
+	lval* args = lval_copy(v);
+	lval_delete(lval_pop(args, 0));
+	lval* x = lmacro_subst(m->body, m->params, args, binders, fresh);
+	lval_delete(args);
+	lval_delete(binders);
+	lval_delete(fresh);
+
+	//the expansion takes the place of the call, so keep its kind
+	x->type = v->type;
+	lmacro_depth++;
+	x = lval_expand(x);
+	lmacro_depth--;
+
+	if(!cache){
+		lval_delete(v);
+		return x;
+	}
+	if(c->form){
+		lval_delete(c->form);
+		lval_delete(c->expansion);
+	}
+	c->hash = h;
+	c->form = lval_promote(v);
+	c->expansion = lval_promote(x);
+	lval_delete(v);
+	return x;
+}
+
+//expand an argument of a form. Quoted code is expanded like an
+//s-expression, other quoted lists are data and are left alone
+lval* lval_expand_arg(lval* v, int code){
+	if(v->type == LVAL_SEXPR || (code && v->type == LVAL_QEXPR)) { return lval_expand(v); }
+	return v;
+}
+
+//expand the initial values of the bindings of let, let*, letrec and loop,
+//or the count of dotimes, shadowing macros as the names come into scope
+void lval_expand_binds(lval* b, char* head){
+	if(b->type != LVAL_SEXPR && b->type != LVAL_QEXPR) { return; }
+	lval_own(b);
+
+	if(head == lsym_intern("dotimes")){
+		if(b->count != 2) { return; }
+		b->cell[1] = LREF(lval_expand_arg(LPTR(b->cell[1]), 0));
+		lmacro_bind(LPTR(b->cell[0]));
+		return;
+	}
+
+	int rec = head == lsym_intern("letrec");
+	int seq = rec || head != lsym_intern("let");
+	for(int i = 0; i < b->count && rec; i++){
+		lval* p = LPTR(b->cell[i]);
+		if(p->count == 2) { lmacro_bind(LPTR(p->cell[0])); }
+	}
+	for(int i = 0; i < b->count; i++){
+		lval* p = LPTR(b->cell[i]);
+		if((p->type != LVAL_SEXPR && p->type != LVAL_QEXPR) || p->count != 2) { continue; }
+		lval_own(p);
+		p->cell[1] = LREF(lval_expand_arg(LPTR(p->cell[1]), 0));
+		if(seq && !rec) { lmacro_bind(LPTR(p->cell[0])); }
+	}
+	for(int i = 0; i < b->count && !seq; i++){
+		lval* p = LPTR(b->cell[i]);
+		if(p->count == 2) { lmacro_bind(LPTR(p->cell[0])); }
+	}
+}
+
+//expand every macro call in a form of code. Runs once on each form that
+//is read. Only code is expanded: s-expressions, and the quoted bodies of
+//lambdas and if branches. Quoted data and the names bound by a form are
+//left as they are, and a variable hides a macro of the same name
+lval* lval_expand(lval* v){
+	if(v->type != LVAL_SEXPR && v->type != LVAL_QEXPR) { return v; }
+
+	char* head = v->count > 0 && LPTR(v->cell[0])->type == LVAL_SYM ? LPTR(v->cell[0])->sym : NULL;
+	if(head == lsym_intern("defmacro")) { return builtin_defmacro(v); }
+	lmacro* m = lmacro_call(v);
+	if(m) { return lmacro_expand(m, v); }
+
+	int base = lmacro_shadow_count;
+	int lambda = head == lsym_intern("\\") && v->count == 3;
+	lval_own(v);
+	for(int i = 0; i < v->count; i++){
+		lval* x = LPTR(v->cell[i]);
+		if(i == 1 && lambda){
+			for(int j = 0; j < x->count && x->type == LVAL_QEXPR; j++) { lmacro_bind(LPTR(x->cell[j])); }
+		} else if(i == 1 && head && head != lsym_intern("while") && lval_special(v)){
+			lval_expand_binds(x, head);
+		} else {
+			v->cell[i] = LREF(lval_expand_arg(x, (lambda && i == 2) || (head == lsym_intern("if") && i >= 2)));
+		}
+	}
+	lmacro_shadow_count = base;
+	return v;
+}
+
+//expand code built or quoted at run time, which was not expanded when it
+//was read. The names bound around it in e hide macros, as binders do
+lval* lval_expand_in(lenv* e, lval* v){
+	if(!lmacro_count) { return v; }
+	int base = lmacro_shadow_count;
+	for(lenv* f = e; f->par; f = f->par){
+		for(int i = 0; i < f->count; i++) { lmacro_shadow_sym(f->syms[i]); }
+	}
+	v = lval_expand(v);
+	lmacro_shadow_count = base;
+	return v;
+}
+
+//expand the top level forms of a program read from a file, each of which
+//is run on its own
+lval* lval_expand_program(lval* prog){
+	lval_own(prog);
+	for(int i = 0; i < prog->count; i++){
+		prog->cell[i] = LREF(lval_expand_arg(LPTR(prog->cell[i]), 0));
+	}
+	return prog;
+}
+
+//state for the constant folding pass over one program
+typedef struct {
+	lenv* env;
+	//names bound by lambdas, lets and loops anywhere in the program
+	lval* bound;
+	//names assigned by def and '=', once per assignment
+	lval* assigned;
+	//set when the program could assign names we cannot see
+	int opaque;
+	//constant defs seen so far, as {name value} pairs
+	lval* consts;
+	//nesting of lambdas being inlined into each other
+	int depth;
+	//set when the whole program is known. Lambda bodies run after the
+	//form that makes them, by which time a builtin they use may have been
+	//rebound by code the scan never saw, so only then are they folded
+	int whole;
+} lfold;
+
+int lval_count_sym(lval* v, char* sym){
+	int n = 0;
+	for(int i = 0; i < v->count; i++){
+		if(LPTR(v->cell[i])->sym == sym) { n++; }
+	}
+	return n;
+}
+
+int lval_is_list(lval* v){
+	return v->type == LVAL_SEXPR || v->type == LVAL_QEXPR;
+}
+
+//record every binding and assignment in the program, code and data alike
+void lfold_scan(lval* v, lfold* st){
+	if(v->type == LVAL_SYM){
+		if(v->sym == lsym_intern("def") || v->sym == lsym_intern("=")) { st->opaque = 1; }
+		return;
+	}
+	if(!lval_is_list(v)) { return; }
+
+	int first = 0;
+	if(v->count > 0 && LPTR(v->cell[0])->type == LVAL_SYM){
+		char* head = LPTR(v->cell[0])->sym;
+		lval* b = v->count > 1 ? LPTR(v->cell[1]) : NULL;
+		first = 1;
+
+		if(head == lsym_intern("def") || head == lsym_intern("=")){
+			if(!b || b->type != LVAL_QEXPR) { st->opaque = 1; return; }
+			for(int i = 0; i < b->count; i++){
+				if(LPTR(b->cell[i])->type != LVAL_SYM) { st->opaque = 1; return; }
+				lval_add(st->assigned, lval_copy(LPTR(b->cell[i])));
+			}
+			first = 2;
+		} else if(b && lval_is_list(b)){
+			if(head == lsym_intern("\\")){
+				for(int i = 0; i < b->count; i++){
+					if(LPTR(b->cell[i])->type == LVAL_SYM) { lval_add(st->bound, lval_copy(LPTR(b->cell[i]))); }
+				}
+			} else if(head == lsym_intern("dotimes")){
+				if(b->count > 0 && LPTR(b->cell[0])->type == LVAL_SYM) { lval_add(st->bound, lval_copy(LPTR(b->cell[0]))); }
+			} else if(lval_special(v)){
+				for(int i = 0; i < b->count; i++){
+					lval* p = LPTR(b->cell[i]);
+					if(lval_is_list(p) && p->count > 0 && LPTR(p->cell[0])->type == LVAL_SYM){
+						lval_add(st->bound, lval_copy(LPTR(p->cell[0])));
+					}
+				}
+			}
+		}
+	}
+
+	for(int i = first; i < v->count; i++){
+		lfold_scan(LPTR(v->cell[i]), st);
+	}
+}
+
+//the builtin a symbol names, if nothing in the program can rebind it
+lbuiltin lfold_builtin(lfold* st, lval* v){
+	if(v->type != LVAL_SYM || st->opaque) { return NULL; }
+	if(lval_find_sym(st->bound, v->sym) >= 0) { return NULL; }
+	if(lval_find_sym(st->assigned, v->sym) >= 0) { return NULL; }
+	lval* f = lenv_lookup(st->env, v->sym);
+	return f && f->type == LVAL_FUN ? f->builtin : NULL;
+}
+
+//builtins without side effects, safe to apply to literal arguments
+int lfold_pure(lbuiltin f){
+	return f == builtin_add || f == builtin_sub || f == builtin_mul || f == builtin_div
+		|| f == builtin_gt || f == builtin_lt || f == builtin_ge || f == builtin_le
+		|| f == builtin_eq || f == builtin_ne;
+}
+
+lval* lfold_code(lval* v, lfold* st);
+
+//fold a quoted body such as a lambda body or an if branch. It is run as
+//an s-expression, so a body that folds to a single value is kept as {value}
+lval* lfold_quoted(lval* q, lfold* st){
+	if(q->type != LVAL_QEXPR) { return lfold_code(q, st); }
+	q->type = LVAL_SEXPR;
+	lval* x = lfold_code(q, st);
+	if(x->type == LVAL_SEXPR){
+		x->type = LVAL_QEXPR;
+		return x;
+	}
+	return lval_add(lval_qexpr(), x);
+}
+
+//lambdas with bodies of up to this many nodes are inlined at call sites
+#define LINLINE_MAX_NODES 16
+#define LINLINE_MAX_DEPTH 4
+
+//count the nodes of a lambda body, or return -1 if it cannot be inlined.
+//Inlined bodies may only hold calls, symbols, numbers and if branches,
+//so a formal can never be rebound or quoted inside them
+int linline_size(lval* v, char* self, lfold* st){
+	if(v->type == LVAL_NUM) { return 1; }
+	if(v->type == LVAL_SYM){
+		lbuiltin f = lfold_builtin(st, v);
+		if(v->sym == self || f == builtin_lambda || f == builtin_def
+			|| f == builtin_put || f == builtin_eval || f == builtin_recur){
+			return -1;
+		}
+		return 1;
+	}
+	if(v->type != LVAL_SEXPR || (v->count > 0 && LPTR(v->cell[0])->type == LVAL_SYM && lval_special(v))){
+		return -1;
+	}
+
+	int n = 1;
+	int branches = v->count == 4 && lfold_builtin(st, LPTR(v->cell[0])) == builtin_if;
+	for(int i = 0; i < v->count; i++){
+		lval* c = LPTR(v->cell[i]);
+		int m;
+		if(branches && i >= 2 && c->type == LVAL_QEXPR){
+			c->type = LVAL_SEXPR;
+			m = linline_size(c, self, st);
+			c->type = LVAL_QEXPR;
+		} else {
+			m = linline_size(c, self, st);
+		}
+		if(m < 0) { return -1; }
+		n += m;
+	}
+	return n;
+}
+
+//replace formals with their arguments throughout a body
+lval* linline_subst(lval* v, lval* formals, lval** args){
+	if(v->type == LVAL_SYM){
+		int i = lval_find_sym(formals, v->sym);
+		if(i >= 0 && args[i]){
+			lval_delete(v);
+			return lval_copy(args[i]);
+		}
+		return v;
+	}
+	if(lval_is_list(v)){
+		lval_own(v);
+		for(int i = 0; i < v->count; i++){
+			v->cell[i] = LREF(linline_subst(LPTR(v->cell[i]), formals, args));
+		}
+	}
+	return v;
+}
+
+int linline_uses(lval* v, char* sym){
+	if(v->type == LVAL_SYM) { return v->sym == sym; }
+	int n = 0;
+	if(lval_is_list(v)){
+		for(int i = 0; i < v->count; i++){ n += linline_uses(LPTR(v->cell[i]), sym); }
+	}
+	return n;
+}
+
+//whether a body calls anything other than builtins, which could assign
+//the names read by the body while it runs
+int linline_calls(lval* v, lfold* st){
+	if(!lval_is_list(v)) { return 0; }
+	if(v->type == LVAL_SEXPR && v->count > 1 && !lfold_builtin(st, LPTR(v->cell[0]))) { return 1; }
+	for(int i = 0; i < v->count; i++){
+		if(linline_calls(LPTR(v->cell[i]), st)) { return 1; }
+	}
+	return 0;
+}
+
+//walk a body in evaluation order, up to the first step that could fail
+//other than reading a formal. The symbol arguments marked 1 in mode that
+//are read before it, in argument order, are marked 2: the body looks each
+//of them up where the call would have, so they can be substituted
+int linline_order(lval* v, lval* formals, int* mode, lfold* st){
+	if(v->type == LVAL_SYM){
+		int i = lval_find_sym(formals, v->sym);
+		if(i < 0) { return lfold_builtin(st, v) != NULL; }
+		if(mode[i] != 1) { return 1; }
+		for(int j = 0; j < i; j++){
+			if(mode[j] == 1) { return 0; }
+		}
+		mode[i] = 2;
+		return 1;
+	}
+	if(v->type != LVAL_SEXPR) { return 1; }
+	for(int i = 0; i < v->count; i++){
+		if(!linline_order(LPTR(v->cell[i]), formals, mode, st)) { return 0; }
+	}
+	//applying a call may fail, and if branches run after it
+	return v->count < 2;
+}
+
+//inline a call to a small lambda bound in the global environment.
+//The call becomes (inline# f {formals} {body} {inlined} {call}): a guard
+//that runs the inlined body while f still resolves to a lambda with the
+//same formals and body, and the original call once f has been redefined
+//with def or '='
+lval* lfold_inline(lval* v, lfold* st){
+	//a lambda alone in parentheses is not called, it evaluates to itself
+	lval* h = LPTR(v->cell[0]);
+	if(v->count < 2 || h->type != LVAL_SYM || st->depth >= LINLINE_MAX_DEPTH) { return NULL; }
+	if(lval_find_sym(st->bound, h->sym) >= 0) { return NULL; }
+
+	lval* fn = lenv_lookup(st->env, h->sym);
+	if(!fn || fn->type != LVAL_FUN || fn->builtin || fn->env->count != 0) { return NULL; }
+	if(fn->formals->count != v->count - 1 || fn->body->type != LVAL_QEXPR) { return NULL; }
+	for(int i = 0; i < fn->formals->count; i++){
+		if(LPTR(fn->formals->cell[i])->type != LVAL_SYM) { return NULL; }
+	}
+
+	fn->body->type = LVAL_SEXPR;
+	int size = linline_size(fn->body, h->sym, st);
+	fn->body->type = LVAL_QEXPR;
+	if(size < 0 || size > LINLINE_MAX_NODES) { return NULL; }
+
+	//numbers are substituted, and so are symbols that no formal can capture
+	//when the body looks them up as the call would have: before anything
+	//else that could fail, in the same order, and with nothing in between
+	//that could assign them. Everything else is bound once by a let, in
+	//argument order, ahead of the body. Under dynamic scope a lambda the
+	//body calls can read any formal, so then every formal is bound
+	int n = fn->formals->count;
+	lval* args[n + 1];
+	int mode[n + 1];
+	fn->body->type = LVAL_SEXPR;
+	int calls = linline_calls(fn->body, st);
+	fn->body->type = LVAL_QEXPR;
+	for(int i = 0; i < n; i++){
+		lval* a = LPTR(v->cell[i + 1]);
+		mode[i] = a->type == LVAL_NUM && !calls ? 0 : 3;
+		if(a->type == LVAL_SYM && !calls && lval_find_sym(fn->formals, a->sym) < 0
+			&& linline_uses(fn->body, LPTR(fn->formals->cell[i])->sym) > 0){
+			mode[i] = 1;
+		}
+		//arguments bound by the let are evaluated first
+		if(mode[i] == 3){
+			for(int j = 0; j < i; j++){
+				if(mode[j] == 1) { mode[j] = 3; }
+			}
+		}
+	}
+	fn->body->type = LVAL_SEXPR;
+	linline_order(fn->body, fn->formals, mode, st);
+	fn->body->type = LVAL_QEXPR;
+
+	lval* binds = lval_qexpr();
+	for(int i = 0; i < n; i++){
+		lval* a = LPTR(v->cell[i + 1]);
+		lval* formal = LPTR(fn->formals->cell[i]);
+		args[i] = NULL;
+		if(mode[i] == 0 || mode[i] == 2){
+			//an unused formal bound to a number is simply dropped
+			args[i] = a;
+		} else {
+			lval* b = lval_qexpr();
+			lval_add(b, lval_copy(formal));
+			lval_add(b, lval_copy(a));
+			lval_add(binds, b);
+		}
+	}
+
+	lval* body = linline_subst(lval_copy(fn->body), fn->formals, args);
+	body->type = LVAL_SEXPR;
+	if(binds->count){
+		lval* let = lval_sexpr();
+		lval_add(let, lval_sym("let"));
+		lval_add(let, binds);
+		lval_add(let, body);
+		body = let;
+	} else {
+		lval_delete(binds);
+	}
+
+	st->depth++;
+	body = lfold_code(body, st);
+	st->depth--;
+	if(body->type == LVAL_SEXPR){
+		body->type = LVAL_QEXPR;
+	} else {
+		body = lval_add(lval_qexpr(), body);
+	}
+
+	lval* x = lval_sexpr();
+	lval_add(x, lval_sym("inline#"));
+	lval_add(x, lval_copy(h));
+	lval_add(x, lval_copy(fn->formals));
+	lval_add(x, lval_copy(fn->body));
+	lval_add(x, body);
+	v->type = LVAL_QEXPR;
+	lval_add(x, v);
+	return x;
+}
+
+//fold an expression in code position
+lval* lfold_code(lval* v, lfold* st){
+	if(v->type == LVAL_SYM){
+		//inline a constant def
+		for(int i = 0; i < st->consts->count; i++){
+			if(LPTR(LPTR(st->consts->cell[i])->cell[0])->sym == v->sym){
+				lval_delete(v);
+				return lval_copy(LPTR(LPTR(st->consts->cell[i])->cell[1]));
+			}
+		}
+		return v;
+	}
+
+	//quoted data evaluates to itself
+	if(v->type != LVAL_SEXPR || v->count == 0) { return v; }
+
+	lval_own(v);
+	lval* h = LPTR(v->cell[0]);
+	lbuiltin f = lfold_builtin(st, h);
+
+	if(h->type == LVAL_SYM && lval_special(v)){
+		if(h->sym == lsym_intern("dotimes") || h->sym == lsym_intern("while")){
+			int first = 1;
+			if(h->sym == lsym_intern("dotimes")){
+				lval* b = LPTR(v->cell[1]);
+				if(lval_is_list(b) && b->count == 2) {
+					lval_own(b);
+					b->cell[1] = LREF(lfold_code(LPTR(b->cell[1]), st));
+				}
+				first = 2;
+			}
+			for(int i = first; i < v->count; i++){
+				v->cell[i] = LREF(lfold_code(LPTR(v->cell[i]), st));
+			}
+			//a loop that never runs
+			if(h->sym == lsym_intern("while") && LPTR(v->cell[1])->type == LVAL_NUM && LPTR(v->cell[1])->num == 0){
+				lval_delete(v);
+				return lval_sexpr();
+			}
+			return v;
+		}
+
+		//let and loop forms: fold the initial values and the body
+		lval* b = LPTR(v->cell[1]);
+		if(lval_is_list(b)){
+			lval_own(b);
+			for(int i = 0; i < b->count; i++){
+				lval* p = LPTR(b->cell[i]);
+				if(lval_is_list(p) && p->count == 2) {
+					lval_own(p);
+					p->cell[1] = LREF(lfold_code(LPTR(p->cell[1]), st));
+				}
+			}
+		}
+		for(int i = 2; i < v->count; i++){
+			v->cell[i] = LREF(lfold_code(LPTR(v->cell[i]), st));
+		}
+		return v;
+	}
+
+	if(f == builtin_lambda){
+		if(v->count == 3 && st->whole) { v->cell[2] = LREF(lfold_quoted(LPTR(v->cell[2]), st)); }
+		return v;
+	}
+
+	if(f == builtin_def || f == builtin_put){
+		for(int i = 2; i < v->count; i++){
+			v->cell[i] = LREF(lfold_code(LPTR(v->cell[i]), st));
+		}
+		return v;
+	}
+
+	if(f == builtin_eval){
+		if(v->count == 2) { v->cell[1] = LREF(lfold_quoted(LPTR(v->cell[1]), st)); }
+		return v;
+	}
+
+	if(f == builtin_if && v->count == 4){
+		v->cell[1] = LREF(lfold_code(LPTR(v->cell[1]), st));
+		v->cell[2] = LREF(lfold_quoted(LPTR(v->cell[2]), st));
+		v->cell[3] = LREF(lfold_quoted(LPTR(v->cell[3]), st));
+
+		//drop the branch that can never be taken
+		if(LPTR(v->cell[1])->type == LVAL_NUM && LPTR(v->cell[2])->type == LVAL_QEXPR
+			&& LPTR(v->cell[3])->type == LVAL_QEXPR){
+			lval* x = lval_take(v, LPTR(v->cell[1])->num ? 2 : 3);
+			x->type = LVAL_SEXPR;
+			return x;
+		}
+		return v;
+	}
+
+	for(int i = 0; i < v->count; i++){
+		v->cell[i] = LREF(lfold_code(LPTR(v->cell[i]), st));
+	}
+
+	//a single value in parentheses is just that value
+	if(v->count == 1 && LPTR(v->cell[0])->type == LVAL_NUM){
+		return lval_take(v, 0);
+	}
+
+	if(!f){
+		lval* x = lfold_inline(v, st);
+		return x ? x : v;
+	}
+	//a builtin alone in parentheses is not a call, it evaluates to itself
+	if(!lfold_pure(f) || v->count < 2) { return v; }
+	for(int i = 1; i < v->count; i++){
+		if(LPTR(v->cell[i])->type != LVAL_NUM) { return v; }
+	}
+
+	//apply the builtin now, unless it fails, so errors such as division
+	//by zero are still raised when the form is evaluated
+	lval* a = lval_copy(v);
+	lval_delete(lval_pop(a, 0));
+	lval* x = f(st->env, a);
+	if(x->type == LVAL_ERR){
+		lval_delete(x);
+		return v;
+	}
+	lval_delete(v);
+	return x;
+}
+
+//record the names a top level form binds to constants. Only names that
+//are assigned exactly once and never rebound qualify, and only uses in
+//later forms are replaced
+void lfold_consts(lval* v, lfold* st){
+	if(v->type != LVAL_SEXPR || v->count < 3) { return; }
+	if(lfold_builtin(st, LPTR(v->cell[0])) != builtin_def) { return; }
+
+	lval* syms = LPTR(v->cell[1]);
+	if(syms->type != LVAL_QEXPR || syms->count != v->count - 2) { return; }
+	for(int i = 0; i < syms->count; i++){
+		char* name = LPTR(syms->cell[i])->sym;
+		if(LPTR(v->cell[i + 2])->type != LVAL_NUM) { continue; }
+		if(lval_count_sym(st->assigned, name) != 1) { continue; }
+		if(lval_find_sym(st->bound, name) >= 0) { continue; }
+		lval* c = lval_qexpr();
+		lval_add(c, lval_copy(LPTR(syms->cell[i])));
+		lval_add(c, lval_copy(LPTR(v->cell[i + 2])));
+		lval_add(st->consts, c);
+	}
+}
+
+//start folding a program, whose cells are top level forms evaluated in
+//order. Each form is then folded by lfold_form just before it runs, so
+//lambdas defined by earlier forms can be inlined into later ones. whole
+//is set when nothing else will run in e, see lfold
+lfold* lfold_new(lenv* e, lval* prog, int whole){
+	lfold* st = malloc(sizeof(lfold));
+	st->env = e;
+	st->bound = lval_qexpr();
+	st->assigned = lval_qexpr();
+	st->opaque = 0;
+	st->consts = lval_qexpr();
+	st->depth = 0;
+	st->whole = whole;
+	for(int i = 0; i < prog->count; i++){
+		lfold_scan(LPTR(prog->cell[i]), st);
+	}
+	return st;
+}
+
+//constant folding, inlining and dead code removal for one top level form
+lval* lfold_form(lfold* st, lval* v){
+	v = lfold_code(v, st);
+	if(!st->opaque) { lfold_consts(v, st); }
+	return v;
+}
+
+void lfold_del(lfold* st){
+	lval_delete(st->bound);
+	lval_delete(st->assigned);
+	lval_delete(st->consts);
+	free(st);
+}
+
+//fold a single form typed at the REPL, where later input may rebind
+//anything
+lval* lval_fold(lenv* e, lval* v){
+	lval* prog = lval_add(lval_sexpr(), v);
+	lfold* st = lfold_new(e, prog, 0);
+	v = lfold_form(st, lval_take(prog, 0));
+	lfold_del(st);
+	return v;
+}
+
+//the guard left at a call site by lfold_inline
+lval* builtin_inline(lenv* e, lval* a){
+	lval* f = lenv_lookup(e, LPTR(a->cell[1])->sym);
+	int same = f && f->type == LVAL_FUN && !f->builtin && f->env->count == 0
+		&& lval_eq(f->formals, LPTR(a->cell[2])) && lval_eq(f->body, LPTR(a->cell[3]));
+	lval* x = lval_pop(a, same ? 4 : 5);
+	x->type = LVAL_SEXPR;
+	lval_delete(a);
+	return lval_eval(e, x);
+}
+
+int lval_is_inline(lval* v){
+	return lval_is_list(v) && v->count == 6 && LPTR(v->cell[0])->type == LVAL_SYM
+		&& lval_special(v) == builtin_inline;
+}
+
+//calls before a lambda's body is checked for integer only dataflow
+#define LINT_THRESHOLD 2
+//calls before a typed lambda is compiled to native code
+#define LJIT_THRESHOLD 100
+//guard failures after which a lambda is left to the interpreter for good
+#define LJIT_MAX_DEOPTS 4
+
+//integer IR for lambda bodies that only ever compute on numbers. Values
+//live in a slot array, the arguments first and let bindings after them
+enum { LINT_NUM, LINT_SLOT, LINT_STORE, LINT_SEQ, LINT_NEG,
+	LINT_ADD, LINT_SUB, LINT_MUL, LINT_DIV,
+	LINT_EQ, LINT_NE, LINT_LT, LINT_GT, LINT_LE, LINT_GE, LINT_IF, LINT_CALL };
+
+struct lint {
+	int op;
+	//the constant, or the slot read or written. Calls set it for a self call
+	long num;
+	int count;
+	lint** args;
+	//the typed lambda a call goes to, held by a reference unless a self call
+	lcode* callee;
+	//the typed lambda the call is made from
+	lcode* owner;
+};
+
+lint* lint_new(int op, long num){
+	lint* n = malloc(sizeof(lint));
+	n->op = op;
+	n->num = num;
+	n->count = 0;
+	n->args = NULL;
+	n->callee = NULL;
+	n->owner = NULL;
+	return n;
+}
+
+lint* lint_add(lint* n, lint* x){
+	n->args = realloc(n->args, sizeof(lint*) * (n->count + 1));
+	n->args[n->count++] = x;
+	return n;
+}
+
+void lint_del(lint* n){
+	for(int i = 0; i < n->count; i++) { lint_del(n->args[i]); }
+	if(n->callee && !n->num) { lcode_release(n->callee); }
+	free(n->args);
+	free(n);
+}
+
+//state for inferring one lambda body. Builtins are resolved in env, or
+//through the fold pass when compiling ahead of time
+typedef struct {
+	lenv* env;
+	lfold* fold;
+	//the lambda being typed at run time, which may then speculate on the
+	//free variables and callees it finds in env
+	lcode* code;
+	//names in scope, indexed by slot
+	lval* scope;
+	int slots;
+	//{name} for each builtin used, {name {formals} {body}} for each lambda
+	//inlined or called, {name slot} for each free variable
+	lval* guards;
+	//free variables read, given slots after all others once inferred
+	lval* vars;
+	//when compiling ahead of time, the name and the (\ {formals} {body})
+	//form of the lambda being compiled, which may call itself
+	lval* name;
+	lval* lambda;
+} linfer;
+
+int linfer_slot(linfer* x, char* sym){
+	for(int i = x->scope->count - 1; i >= 0; i--){
+		if(LPTR(x->scope->cell[i])->sym == sym) { return i; }
+	}
+	return -1;
+}
+
+void linfer_bind(linfer* x, char* sym){
+	lval_add(x->scope, lval_sym(sym));
+	if(x->scope->count > x->slots) { x->slots = x->scope->count; }
+}
+
+void linfer_unbind(linfer* x, int base){
+	while(x->scope->count > base){
+		lval_delete(lval_pop(x->scope, x->scope->count - 1));
+	}
+}
+
+//guard on a builtin, or on a lambda given its formals and body
+void linfer_guard(linfer* x, lval* h, lval* formals, lval* body){
+	for(int i = 0; i < x->guards->count; i++){
+		if(LPTR(LPTR(x->guards->cell[i])->cell[0])->sym == h->sym) { return; }
+	}
+	lval* g = lval_add(lval_qexpr(), lval_copy(h));
+	if(formals){
+		//a self call is guarded while its body is inferred as an
+		//s-expression, but the body is kept quoted
+		lval* q = lval_copy(body);
+		q->type = LVAL_QEXPR;
+		lval_add(g, lval_copy(formals));
+		lval_add(g, q);
+	}
+	lval_add(x->guards, g);
+}
+
+lbuiltin linfer_builtin(linfer* x, lval* h){
+	if(linfer_slot(x, h->sym) >= 0) { return NULL; }
+	lbuiltin b = NULL;
+	if(x->fold){
+		b = lfold_builtin(x->fold, h);
+	} else {
+		lval* f = lenv_lookup(x->env, h->sym);
+		b = f && f->type == LVAL_FUN ? f->builtin : NULL;
+	}
+	if(b) { linfer_guard(x, h, NULL, NULL); }
+	return b;
+}
+
+lint* linfer_expr(linfer* x, lval* v);
+
+//speculate that a free variable stays a number. Its slot is numbered
+//from -1 down until the slots of the body are known
+lint* linfer_var(linfer* x, lval* v){
+	if(!x->code) { return NULL; }
+	lval* n = lenv_lookup(x->env, v->sym);
+	if(!n || n->type != LVAL_NUM) { return NULL; }
+
+	int k = lval_find_sym(x->vars, v->sym);
+	if(k < 0){
+		k = x->vars->count;
+		lval_add(x->vars, lval_copy(v));
+	}
+	return lint_new(LINT_SLOT, -1 - k);
+}
+
+//speculate that a call goes to the lambda its name holds now, when that
+//lambda is typed or is the one being typed
+lint* linfer_call(linfer* x, lval* v){
+	lval* h = LPTR(v->cell[0]);
+	if(linfer_slot(x, h->sym) >= 0) { return NULL; }
+
+	//ahead of time, the lambda being compiled is the only one known
+	lcode* c = NULL;
+	lval* formals;
+	lval* body;
+	int self = 1;
+	if(x->code){
+		lval* f = lenv_lookup(x->env, h->sym);
+		if(!f || f->type != LVAL_FUN || f->builtin || f->env->count != 0) { return NULL; }
+		c = f->code;
+		self = c == x->code;
+		formals = f->formals;
+		body = f->body;
+	} else {
+		if(!x->name || x->name->sym != h->sym) { return NULL; }
+		formals = LPTR(x->lambda->cell[1]);
+		body = LPTR(x->lambda->cell[2]);
+	}
+	if(formals->count != v->count - 1) { return NULL; }
+
+	if(!self){
+		if(c->state != LJIT_TYPED && c->state != LJIT_NATIVE) { return NULL; }
+		//the callee's guards become ours, so none of them may name one of
+		//our bindings, which the callee would see, or a free variable
+		for(int i = 0; i < c->guards->count; i++){
+			lval* g = LPTR(c->guards->cell[i]);
+			if(linfer_slot(x, LPTR(g->cell[0])->sym) >= 0) { return NULL; }
+			if(g->count == 2 && LPTR(g->cell[1])->type == LVAL_NUM) { return NULL; }
+		}
+	}
+
+	lint* n = lint_new(LINT_CALL, self);
+	for(int i = 1; i < v->count; i++){
+		lint* a = linfer_expr(x, LPTR(v->cell[i]));
+		if(!a){
+			lint_del(n);
+			return NULL;
+		}
+		lint_add(n, a);
+	}
+
+	linfer_guard(x, h, formals, body);
+	if(!self){
+		for(int i = 0; i < c->guards->count; i++){
+			lval* g = LPTR(c->guards->cell[i]);
+			int seen = 0;
+			for(int j = 0; j < x->guards->count; j++){
+				if(LPTR(LPTR(x->guards->cell[j])->cell[0])->sym == LPTR(g->cell[0])->sym) { seen = 1; }
+			}
+			if(!seen) { lval_add(x->guards, lval_copy(g)); }
+		}
+		c->refs++;
+	}
+	n->callee = c;
+	n->owner = x->code;
+	return n;
+}
+
+//a quoted body, such as an if branch, is inferred as the s-expression it runs as
+lint* linfer_quoted(linfer* x, lval* q){
+	if(q->type != LVAL_QEXPR) { return NULL; }
+	q->type = LVAL_SEXPR;
+	lint* n = linfer_expr(x, q);
+	q->type = LVAL_QEXPR;
+	return n;
+}
+
+//apply op to the results of a and the expression v, or free a on failure
+lint* linfer_binary(linfer* x, int op, lint* a, lval* v){
+	lint* b = linfer_expr(x, v);
+	if(!b){
+		lint_del(a);
+		return NULL;
+	}
+	return lint_add(lint_add(lint_new(op, 0), a), b);
+}
+
+lint* linfer_let(linfer* x, lval* v, int seq){
+	lval* b = LPTR(v->cell[1]);
+	if(!lval_is_list(b) || v->count < 3) { return NULL; }
+	for(int i = 0; i < b->count; i++){
+		lval* p = LPTR(b->cell[i]);
+		if(!lval_is_list(p) || p->count != 2 || LPTR(p->cell[0])->type != LVAL_SYM) { return NULL; }
+	}
+
+	//a plain let reserves its slots under a name no code can use, so
+	//they are only visible once every initial value is computed
+	int base = x->scope->count;
+	if(!seq){
+		for(int i = 0; i < b->count; i++) { linfer_bind(x, ""); }
+	}
+
+	lint* n = lint_new(LINT_SEQ, 0);
+	for(int i = 0; i < b->count; i++){
+		lint* init = linfer_expr(x, LPTR(LPTR(b->cell[i])->cell[1]));
+		if(!init) { break; }
+		if(seq) { linfer_bind(x, LPTR(LPTR(b->cell[i])->cell[0])->sym); }
+		lint_add(n, lint_add(lint_new(LINT_STORE, seq ? x->scope->count - 1 : base + i), init));
+	}
+	if(n->count == b->count && !seq){
+		for(int i = 0; i < b->count; i++){
+			LPTR(x->scope->cell[base + i])->sym = LPTR(LPTR(b->cell[i])->cell[0])->sym;
+		}
+	}
+	for(int i = 2; i < v->count && n->count == b->count + i - 2; i++){
+		lint* body = linfer_expr(x, LPTR(v->cell[i]));
+		if(body) { lint_add(n, body); }
+	}
+
+	linfer_unbind(x, base);
+	if(n->count != b->count + v->count - 2){
+		lint_del(n);
+		return NULL;
+	}
+	return n;
+}
+
+//translate an expression to the IR, or return NULL if it may compute on
+//anything other than numbers
+lint* linfer_expr(linfer* x, lval* v){
+	if(v->type == LVAL_NUM) { return lint_new(LINT_NUM, v->num); }
+	if(v->type == LVAL_SYM){
+		int k = linfer_slot(x, v->sym);
+		return k < 0 ? linfer_var(x, v) : lint_new(LINT_SLOT, k);
+	}
+	if(v->type != LVAL_SEXPR || v->count == 0) { return NULL; }
+	if(v->count == 1) { return linfer_expr(x, LPTR(v->cell[0])); }
+	if(LPTR(v->cell[0])->type != LVAL_SYM) { return NULL; }
+
+	lbuiltin form = lval_special(v);
+	if(form == builtin_let) { return linfer_let(x, v, 0); }
+	if(form == builtin_let_star) { return linfer_let(x, v, 1); }
+	if(form == builtin_inline){
+		if(linfer_slot(x, LPTR(v->cell[1])->sym) >= 0) { return NULL; }
+		linfer_guard(x, LPTR(v->cell[1]), LPTR(v->cell[2]), LPTR(v->cell[3]));
+		return linfer_quoted(x, LPTR(v->cell[4]));
+	}
+	if(form) { return NULL; }
+
+	lbuiltin f = linfer_builtin(x, LPTR(v->cell[0]));
+	if(!f) { return linfer_call(x, v); }
+	if(f == builtin_if){
+		if(v->count != 4) { return NULL; }
+		lint* n = lint_new(LINT_IF, 0);
+		for(int i = 1; i < 4; i++){
+			lint* a = i == 1 ? linfer_expr(x, LPTR(v->cell[i])) : linfer_quoted(x, LPTR(v->cell[i]));
+			if(!a){
+				lint_del(n);
+				return NULL;
+			}
+			lint_add(n, a);
+		}
+		return n;
+	}
+
+	int op = -1;
+	if(f == builtin_add) { op = LINT_ADD; }
+	if(f == builtin_sub) { op = LINT_SUB; }
+	if(f == builtin_mul) { op = LINT_MUL; }
+	if(f == builtin_div) { op = LINT_DIV; }
+	if(op >= 0){
+		lint* n = linfer_expr(x, LPTR(v->cell[1]));
+		if(n && v->count == 2 && op == LINT_SUB) { n = lint_add(lint_new(LINT_NEG, 0), n); }
+		for(int i = 2; i < v->count && n; i++){
+			n = linfer_binary(x, op, n, LPTR(v->cell[i]));
+		}
+		return n;
+	}
+
+	if(f == builtin_eq) { op = LINT_EQ; }
+	if(f == builtin_ne) { op = LINT_NE; }
+	if(f == builtin_lt) { op = LINT_LT; }
+	if(f == builtin_gt) { op = LINT_GT; }
+	if(f == builtin_le) { op = LINT_LE; }
+	if(f == builtin_ge) { op = LINT_GE; }
+	if(op >= 0 && v->count == 3){
+		lint* a = linfer_expr(x, LPTR(v->cell[1]));
+		return a ? linfer_binary(x, op, a, LPTR(v->cell[2])) : NULL;
+	}
+	return NULL;
+}
+
+//fill in the builtins behind {name} guards as they are in e now
+int lcode_guards(lenv* e, lval* guards){
+	for(int i = 0; i < guards->count; i++){
+		lval* g = LPTR(guards->cell[i]);
+		if(g->count != 1) { continue; }
+		lval* f = lenv_lookup(e, LPTR(g->cell[0])->sym);
+		if(!f || f->type != LVAL_FUN || !f->builtin) { return 0; }
+		lval_add(g, lval_copy(f));
+	}
+	return 1;
+}
+
+//give free variables the slots after every other
+void lint_vars(lint* n, int base){
+	if(n->op == LINT_SLOT && n->num < 0) { n->num = base - 1 - n->num; }
+	for(int i = 0; i < n->count; i++) { lint_vars(n->args[i], base); }
+}
+
+//infer a lambda's body from the environment it is called in. Typed
+//lambdas run on the IR with their numbers unboxed. Only lambdas that
+//have been passed nothing but numbers so far are worth specializing
+void lcode_type(lcode* c, lval* f, lenv* e){
+	c->state = LJIT_UNSUPPORTED;
+	if(c->seen & ~(1u << LVAL_NUM)) { return; }
+	for(int i = 0; i < f->formals->count; i++){
+		if(LPTR(f->formals->cell[i])->type != LVAL_SYM) { return; }
+	}
+
+	//the guards live as long as the lambda, not the form calling it
+	lregion_heap++;
+	linfer x = { e, NULL, c, lval_copy(f->formals), f->formals->count, lval_qexpr(), lval_qexpr(), NULL, NULL };
+	lint* n = linfer_quoted(&x, f->body);
+	if(n && lcode_guards(e, x.guards)){
+		lint_vars(n, x.slots);
+		for(int i = 0; i < x.vars->count; i++){
+			lval* g = lval_add(lval_qexpr(), lval_copy(LPTR(x.vars->cell[i])));
+			lval_add(x.guards, lval_add(g, lval_num(x.slots + i)));
+		}
+		c->ints = n;
+		c->vars = x.slots;
+		c->slots = x.slots + x.vars->count > 0 ? x.slots + x.vars->count : 1;
+		c->guards = x.guards;
+		c->state = LJIT_TYPED;
+	} else {
+		if(n) { lint_del(n); }
+		lval_delete(x.guards);
+	}
+	lval_delete(x.scope);
+	lval_delete(x.vars);
+	lregion_heap--;
+}
+
+//a guard failed, so the environment changed under the typed code. Drop
+//it and specialize again from fresh feedback
+void lcode_deopt(lcode* c){
+#ifdef LJIT_ENABLED
+	if(c->mem) { munmap(c->mem, c->size); }
+#endif
+	c->mem = NULL;
+	c->native = NULL;
+	if(c->ints) { lint_del(c->ints); }
+	c->ints = NULL;
+	lval_delete(c->guards);
+	c->guards = NULL;
+	c->calls = 0;
+	c->seen = 0;
+	c->stale = 0;
+	c->state = ++c->deopts < LJIT_MAX_DEOPTS ? LJIT_COLD : LJIT_UNSUPPORTED;
+}
+
+long lint_eval(lint* n, long* slots, int* fail);
+void lcode_enter(lcode* c, lval* f, lenv* e);
+
+//typed lambdas that called one no longer typed. They cannot be dropped
+//while typed code may still be running them, so they wait here for it to
+//return to the interpreter
+static lcode** lcode_stale = NULL;
+static int lcode_stale_count = 0;
+static int lcode_stale_cap = 0;
+
+void lcode_mark_stale(lcode* c){
+	if(!c || c->stale) { return; }
+	if(lcode_stale_count == lcode_stale_cap){
+		lcode_stale_cap = lcode_stale_cap ? lcode_stale_cap * 2 : 8;
+		lcode_stale = realloc(lcode_stale, sizeof(lcode*) * lcode_stale_cap);
+	}
+	c->stale = 1;
+	c->refs++;
+	lcode_stale[lcode_stale_count++] = c;
+}
+
+//run typed code entered from the interpreter, then drop whatever went stale
+//under it, so the next call types again against its callees as they are
+long lcode_run(lcode* c, long* slots, int* fail){
+	long r = c->state == LJIT_NATIVE ? c->native(slots, fail) : lint_eval(c->ints, slots, fail);
+	while(lcode_stale_count){
+		lcode* s = lcode_stale[--lcode_stale_count];
+		if(s->state == LJIT_TYPED || s->state == LJIT_NATIVE) { lcode_deopt(s); }
+		s->stale = 0;
+		lcode_release(s);
+	}
+	return r;
+}
+
+//a call from typed code to typed code. A self call shares the caller's
+//free variables, which cannot have changed in between. A callee that was
+//deopted fails the call, and its caller and theirs are deopted on return
+long lint_call(lint* n, long* args, long* caller, int* fail){
+	lcode* c = n->callee;
+	if(c->state != LJIT_TYPED && c->state != LJIT_NATIVE){
+		lcode_mark_stale(n->owner);
+		*fail = 1;
+		return 0;
+	}
+	lcode_enter(c, NULL, NULL);
+	long slots[c->slots];
+	memcpy(slots, args, sizeof(long) * n->count);
+	if(c->slots > c->vars) { memcpy(slots + c->vars, caller + c->vars, sizeof(long) * (c->slots - c->vars)); }
+	long r = c->state == LJIT_NATIVE ? c->native(slots, fail) : lint_eval(c->ints, slots, fail);
+	if(c->stale) { lcode_mark_stale(n->owner); }
+	return r;
+}
+
+//evaluate the IR. Arithmetic wraps rather than overflowing, and division
+//by zero sets *fail so the interpreter can raise its error
+long lint_eval(lint* n, long* slots, int* fail){
+	if(n->op == LINT_NUM) { return n->num; }
+	if(n->op == LINT_SLOT) { return slots[n->num]; }
+	if(n->op == LINT_STORE) { return slots[n->num] = lint_eval(n->args[0], slots, fail); }
+	if(n->op == LINT_SEQ){
+		long r = 0;
+		for(int i = 0; i < n->count; i++) { r = lint_eval(n->args[i], slots, fail); }
+		return r;
+	}
+	if(n->op == LINT_IF){
+		return lint_eval(n->args[lint_eval(n->args[0], slots, fail) ? 1 : 2], slots, fail);
+	}
+	if(n->op == LINT_CALL){
+		long args[n->count + 1];
+		for(int i = 0; i < n->count; i++) { args[i] = lint_eval(n->args[i], slots, fail); }
+		return lint_call(n, args, slots, fail);
+	}
+
+	unsigned long a = lint_eval(n->args[0], slots, fail);
+	if(n->op == LINT_NEG) { return (long)(0UL - a); }
+	unsigned long b = lint_eval(n->args[1], slots, fail);
+
+	switch(n->op){
+		case LINT_ADD: return (long)(a + b);
+		case LINT_SUB: return (long)(a - b);
+		case LINT_MUL: return (long)(a * b);
+		case LINT_DIV:
+			if(b == 0){
+				*fail = 1;
+				return 0;
+			}
+			return (long)a / (long)b;
+		case LINT_EQ: return (long)a == (long)b;
+		case LINT_NE: return (long)a != (long)b;
+		case LINT_LT: return (long)a < (long)b;
+		case LINT_GT: return (long)a > (long)b;
+		case LINT_LE: return (long)a <= (long)b;
+		case LINT_GE: return (long)a >= (long)b;
+	}
+	return 0;
+}
+
+//template JIT over the IR. Every node expands to a fixed x86-64 sequence
+//that leaves its result in rax. rbx holds the slot array and r12 the
+//fail flag
+typedef struct {
+	unsigned char* buf;
+	int len;
+	int cap;
+	//offsets of the rel32 jumps to the fail exit
+	int* fails;
+	int nfails;
+	//values pushed on the machine stack, to keep calls 16 byte aligned
+	int depth;
+} ljit;
+
+void ljit_byte(ljit* j, int b){
+	if(j->len == j->cap){
+		j->cap = j->cap ? j->cap * 2 : 256;
+		j->buf = realloc(j->buf, j->cap);
+	}
+	j->buf[j->len++] = (unsigned char)b;
+}
+
+void ljit_emit(ljit* j, int n, ...){
+	va_list va;
+	va_start(va, n);
+	for(int i = 0; i < n; i++) { ljit_byte(j, va_arg(va, int)); }
+	va_end(va);
+}
+
+void ljit_imm32(ljit* j, int x){
+	for(int i = 0; i < 4; i++) { ljit_byte(j, (x >> (8 * i)) & 0xFF); }
+}
+
+void ljit_imm64(ljit* j, long x){
+	for(int i = 0; i < 8; i++) { ljit_byte(j, (int)((unsigned long)x >> (8 * i)) & 0xFF); }
+}
+
+//point the rel32 at offset 'at' to the current position
+void ljit_patch(ljit* j, int at){
+	int rel = j->len - (at + 4);
+	memcpy(&j->buf[at], &rel, 4);
+}
+
+void ljit_node(ljit* j, lint* n){
+	switch(n->op){
+		case LINT_NUM:
+			ljit_emit(j, 2, 0x48, 0xB8);
+			ljit_imm64(j, n->num);
+		return;
+		case LINT_SLOT:
+			ljit_emit(j, 3, 0x48, 0x8B, 0x83);
+			ljit_imm32(j, 8 * n->num);
+		return;
+		case LINT_STORE:
+			ljit_node(j, n->args[0]);
+			ljit_emit(j, 3, 0x48, 0x89, 0x83);
+			ljit_imm32(j, 8 * n->num);
+		return;
+		case LINT_SEQ:
+			for(int i = 0; i < n->count; i++) { ljit_node(j, n->args[i]); }
+		return;
+		case LINT_NEG:
+			ljit_node(j, n->args[0]);
+			ljit_emit(j, 3, 0x48, 0xF7, 0xD8);
+		return;
+		case LINT_CALL: {
+			//arguments are pushed last first, so they lie in order from rsp
+			int pad = (j->depth + n->count) % 2;
+			if(pad) { ljit_emit(j, 4, 0x48, 0x83, 0xEC, 0x08); }
+			j->depth += pad;
+			for(int i = n->count - 1; i >= 0; i--){
+				ljit_node(j, n->args[i]);
+				ljit_emit(j, 1, 0x50);
+				j->depth++;
+			}
+
+			//lint_call(n, rsp, rbx, r12)
+			ljit_emit(j, 2, 0x48, 0xBF);
+			ljit_imm64(j, (long)n);
+			ljit_emit(j, 9, 0x48, 0x89, 0xE6, 0x48, 0x89, 0xDA, 0x4C, 0x89, 0xE1);
+			ljit_emit(j, 2, 0x48, 0xB8);
+			ljit_imm64(j, (long)lint_call);
+			ljit_emit(j, 2, 0xFF, 0xD0);
+
+			ljit_emit(j, 3, 0x48, 0x81, 0xC4);
+			ljit_imm32(j, 8 * (n->count + pad));
+			j->depth -= n->count + pad;
+		}
+		return;
+		case LINT_IF: {
+			ljit_node(j, n->args[0]);
+			ljit_emit(j, 5, 0x48, 0x85, 0xC0, 0x0F, 0x84);
+			int to_else = j->len;
+			ljit_imm32(j, 0);
+			ljit_node(j, n->args[1]);
+			ljit_emit(j, 1, 0xE9);
+			int to_end = j->len;
+			ljit_imm32(j, 0);
+			ljit_patch(j, to_else);
+			ljit_node(j, n->args[2]);
+			ljit_patch(j, to_end);
+		}
+		return;
+	}
+
+	//binary operators: the left operand is saved on the stack while the
+	//right one is computed, then rax = left, rcx = right
+	ljit_node(j, n->args[0]);
+	ljit_emit(j, 1, 0x50);
+	j->depth++;
+	ljit_node(j, n->args[1]);
+	ljit_emit(j, 4, 0x48, 0x89, 0xC1, 0x58);
+	j->depth--;
+
+	int cc = 0;
+	switch(n->op){
+		case LINT_ADD: ljit_emit(j, 3, 0x48, 0x01, 0xC8); return;
+		case LINT_SUB: ljit_emit(j, 3, 0x48, 0x29, 0xC8); return;
+		case LINT_MUL: ljit_emit(j, 4, 0x48, 0x0F, 0xAF, 0xC1); return;
+		case LINT_DIV:
+			//division by zero goes back to the interpreter for its error
+			ljit_emit(j, 5, 0x48, 0x85, 0xC9, 0x0F, 0x84);
+			j->fails = realloc(j->fails, sizeof(int) * (j->nfails + 1));
+			j->fails[j->nfails++] = j->len;
+			ljit_imm32(j, 0);
+			ljit_emit(j, 5, 0x48, 0x99, 0x48, 0xF7, 0xF9);
+		return;
+		case LINT_EQ: cc = 0x94; break;
+		case LINT_NE: cc = 0x95; break;
+		case LINT_LT: cc = 0x9C; break;
+		case LINT_GE: cc = 0x9D; break;
+		case LINT_LE: cc = 0x9E; break;
+		case LINT_GT: cc = 0x9F; break;
+	}
+	ljit_emit(j, 9, 0x48, 0x39, 0xC8, 0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0);
+}
+
+#ifdef LJIT_ENABLED
+//perf picks up symbols for JIT code from /tmp/perf-<pid>.map
+static FILE* ljit_perf_map = NULL;
+
+void ljit_perf_record(lcode* c, int len){
+	if(!ljit_perf_map){
+		char path[64];
+		snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+		ljit_perf_map = fopen(path, "w");
+		if(!ljit_perf_map) { return; }
+	}
+	fprintf(ljit_perf_map, "%lx %x rylisp:%s\n", (unsigned long)c->mem, len,
+		c->name ? c->name : "lambda");
+	fflush(ljit_perf_map);
+}
+#endif
+
+//compile a typed lambda's IR. It stays on the IR evaluator when there
+//is no JIT for this machine
+void ljit_compile(lcode* c){
+#ifdef LJIT_ENABLED
+	ljit j = { NULL, 0, 0, NULL, 0, 0 };
+
+	//push rbp; mov rbp, rsp; push rbx; push r12; mov rbx, rdi; mov r12, rsi
+	ljit_emit(&j, 12, 0x55, 0x48, 0x89, 0xE5, 0x53, 0x41, 0x54, 0x48, 0x89, 0xFB, 0x49, 0x89);
+	ljit_emit(&j, 1, 0xF4);
+	ljit_node(&j, c->ints);
+
+	//lea rsp, [rbp-16]; pop r12; pop rbx; pop rbp; ret
+	int exit = j.len;
+	ljit_emit(&j, 9, 0x48, 0x8D, 0x65, 0xF0, 0x41, 0x5C, 0x5B, 0x5D, 0xC3);
+
+	//fail: mov dword [r12], 1; xor eax, eax; jmp exit
+	for(int i = 0; i < j.nfails; i++) { ljit_patch(&j, j.fails[i]); }
+	ljit_emit(&j, 11, 0x41, 0xC7, 0x04, 0x24, 0x01, 0x00, 0x00, 0x00, 0x31, 0xC0, 0xE9);
+	ljit_imm32(&j, exit - (j.len + 4));
+
+	size_t size = ((size_t)j.len + 4095) & ~(size_t)4095;
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem != MAP_FAILED){
+		memcpy(mem, j.buf, j.len);
+		mprotect(mem, size, PROT_READ | PROT_EXEC);
+		c->mem = mem;
+		c->size = size;
+		c->native = (ljit_fn)mem;
+		c->state = LJIT_NATIVE;
+		ljit_perf_record(c, j.len);
+	}
+
+	free(j.buf);
+	free(j.fails);
+#else
+	(void)c;
+#endif
+}
+
+//check that the builtins and lambdas the typed code was built against are
+//still what their names resolve to from e, and load its free variables
+int ljit_guard(lcode* c, lenv* e, long* slots){
+	for(int i = 0; i < c->guards->count; i++){
+		lval* g = LPTR(c->guards->cell[i]);
+		lval* f = lenv_lookup(e, LPTR(g->cell[0])->sym);
+		if(g->count == 2 && LPTR(g->cell[1])->type == LVAL_NUM){
+			if(!f || f->type != LVAL_NUM) { return 0; }
+			slots[LPTR(g->cell[1])->num] = f->num;
+			continue;
+		}
+		if(!f || f->type != LVAL_FUN) { return 0; }
+		if(g->count == 2){
+			if(f->builtin != LPTR(g->cell[1])->builtin) { return 0; }
+		} else if(f->builtin || f->env->count != 0
+			|| !lval_eq(f->formals, LPTR(g->cell[1])) || !lval_eq(f->body, LPTR(g->cell[2]))){
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//count a call to the lambda f, however it was reached, and move it up a
+//tier once it is hot enough. Calls from typed code pass no f or e, as the
+//callee is already typed and only has native code left to reach
+void lcode_enter(lcode* c, lval* f, lenv* e){
+	if(c->state != LJIT_COLD && c->state != LJIT_TYPED) { return; }
+	c->calls++;
+	if(c->state == LJIT_COLD && c->calls >= LINT_THRESHOLD) { lcode_type(c, f, e); }
+	if(c->calls == LJIT_THRESHOLD && c->state == LJIT_TYPED) { ljit_compile(c); }
+}
+
+//run a full application of a lambda unboxed once it is typed, natively
+//once it is hot, provided it is passed numbers. Returns NULL to leave the
+//call to the interpreter
+lval* lcode_call(lenv* e, lval* f, lval* a){
+	lcode* c = f->code;
+	if(c->state == LJIT_COLD || c->state == LJIT_TYPED){
+		for(int i = 0; i < a->count; i++) { c->seen |= 1u << LPTR(a->cell[i])->type; }
+	}
+	lcode_enter(c, f, e);
+	if(c->state != LJIT_TYPED && c->state != LJIT_NATIVE) { return NULL; }
+
+	long slots[c->slots];
+	for(int i = 0; i < a->count; i++){
+		if(LPTR(a->cell[i])->type != LVAL_NUM) { return NULL; }
+		slots[i] = LPTR(a->cell[i])->num;
+	}
+	if(!ljit_guard(c, e, slots)){
+		lcode_deopt(c);
+		return NULL;
+	}
+
+	int fail = 0;
+	long r = lcode_run(c, slots, &fail);
+	if(fail) { return NULL; }
+	lval_delete(a);
+	return lval_num(r);
+}
+
+//give the lambda just defined as name native code built ahead of time by
+//--emit-c. Guards are given as linfer records them
+void lcode_install(lenv* e, char* name, ljit_fn fn, int slots, lval* guards){
+	lval* f = lenv_lookup(e, lsym_intern(name));
+	if(!f || f->type != LVAL_FUN || f->builtin || f->code->state != LJIT_COLD
+		|| !lcode_guards(e, guards)){
+		lval_delete(guards);
+		return;
+	}
+
+	f->code->native = fn;
+	f->code->vars = slots;
+	f->code->slots = slots > 0 ? slots : 1;
+	f->code->guards = guards;
+	f->code->state = LJIT_NATIVE;
+}
+
+//growable text buffer for the C the compiler writes
+typedef struct {
+	char* s;
+	int len;
+	int cap;
+} lbuf;
+
+void lbuf_printf(lbuf* b, char* fmt, ...){
+	va_list va;
+	va_start(va, fmt);
+	int n = vsnprintf(NULL, 0, fmt, va);
+	va_end(va);
+
+	if(b->len + n + 1 > b->cap){
+		while(b->len + n + 1 > b->cap) { b->cap = b->cap ? b->cap * 2 : 1024; }
+		b->s = realloc(b->s, b->cap);
+	}
+	va_start(va, fmt);
+	vsnprintf(b->s + b->len, n + 1, fmt, va);
+	va_end(va);
+	b->len += n;
+}
+
+//ahead of time counterpart of ljit: the IR written out as a C function
+//with the ljit_fn signature, one temporary per node
+typedef struct {
+	lbuf* out;
+	int temps;
+	int fails;
+	int indent;
+	//number of the function, which self calls go to, and its slot count
+	int id;
+	int slots;
+} lcgen;
+
+void lcgen_line(lcgen* g, char* fmt, ...){
+	char line[256];
+	va_list va;
+	va_start(va, fmt);
+	vsnprintf(line, sizeof(line), fmt, va);
+	va_end(va);
+	for(int i = 0; i < g->indent; i++) { lbuf_printf(g->out, "\t"); }
+	lbuf_printf(g->out, "%s\n", line);
+}
+
+//write the code for a node and return the number of its temporary.
+//Arithmetic wraps like the other backends
+int lcgen_node(lcgen* g, lint* n){
+	switch(n->op){
+		case LINT_NUM:
+			if(n->num == LONG_MIN){
+				lcgen_line(g, "long t%d = LONG_MIN;", g->temps);
+			} else {
+				lcgen_line(g, "long t%d = %ldL;", g->temps, n->num);
+			}
+		return g->temps++;
+		case LINT_SLOT:
+			lcgen_line(g, "long t%d = slots[%ld];", g->temps, n->num);
+		return g->temps++;
+		case LINT_STORE: {
+			int t = lcgen_node(g, n->args[0]);
+			lcgen_line(g, "slots[%ld] = t%d;", n->num, t);
+			return t;
+		}
+		case LINT_SEQ: {
+			int t = -1;
+			for(int i = 0; i < n->count; i++) { t = lcgen_node(g, n->args[i]); }
+			return t;
+		}
+		case LINT_NEG: {
+			int t = lcgen_node(g, n->args[0]);
+			lcgen_line(g, "long t%d = (long)(0UL - (unsigned long)t%d);", g->temps, t);
+			return g->temps++;
+		}
+		case LINT_IF: {
+			int c = lcgen_node(g, n->args[0]);
+			int r = g->temps++;
+			lcgen_line(g, "long t%d;", r);
+			lcgen_line(g, "if(t%d){", c);
+			g->indent++;
+			lcgen_line(g, "t%d = t%d;", r, lcgen_node(g, n->args[1]));
+			g->indent--;
+			lcgen_line(g, "} else {");
+			g->indent++;
+			lcgen_line(g, "t%d = t%d;", r, lcgen_node(g, n->args[2]));
+			g->indent--;
+			lcgen_line(g, "}");
+			return r;
+		}
+		case LINT_CALL: {
+			//only self calls are compiled, straight to the C function
+			int a = g->temps++;
+			int r = g->temps++;
+			int args[n->count + 1];
+			for(int i = 0; i < n->count; i++) { args[i] = lcgen_node(g, n->args[i]); }
+			lcgen_line(g, "long t%d[%d];", a, g->slots);
+			for(int i = 0; i < n->count; i++) { lcgen_line(g, "t%d[%d] = t%d;", a, i, args[i]); }
+			lcgen_line(g, "long t%d = rl_fn_%d(t%d, fail);", r, g->id, a);
+			lcgen_line(g, "if(*fail) { return 0; }");
+			return r;
+		}
+	}
+
+	int a = lcgen_node(g, n->args[0]);
+	int b = lcgen_node(g, n->args[1]);
+	char* op = "==";
+	switch(n->op){
+		case LINT_ADD: op = "+"; break;
+		case LINT_SUB: op = "-"; break;
+		case LINT_MUL: op = "*"; break;
+		case LINT_DIV:
+			lcgen_line(g, "if(t%d == 0) { goto fail; }", b);
+			lcgen_line(g, "long t%d = t%d / t%d;", g->temps, a, b);
+			g->fails = 1;
+		return g->temps++;
+		case LINT_NE: op = "!="; break;
+		case LINT_LT: op = "<"; break;
+		case LINT_GT: op = ">"; break;
+		case LINT_LE: op = "<="; break;
+		case LINT_GE: op = ">="; break;
+	}
+	if(n->op <= LINT_MUL){
+		lcgen_line(g, "long t%d = (long)((unsigned long)t%d %s (unsigned long)t%d);",
+			g->temps, a, op, b);
+	} else {
+		lcgen_line(g, "long t%d = t%d %s t%d;", g->temps, a, op, b);
+	}
+	return g->temps++;
+}
+
+//write a symbol as a C string literal
+void lemit_str(lbuf* b, char* s){
+	lbuf_printf(b, "\"");
+	for(; *s; s++){
+		if(*s == '\\' || *s == '"') { lbuf_printf(b, "\\"); }
+		lbuf_printf(b, "%c", *s);
+	}
+	lbuf_printf(b, "\"");
+}
+
+//write the constructor calls that build a value
+void lemit_lval(lbuf* b, lval* v){
+	switch(v->type){
+		case LVAL_NUM:
+			if(v->num == LONG_MIN){
+				lbuf_printf(b, "lval_num(LONG_MIN)");
+			} else {
+				lbuf_printf(b, "lval_num(%ldL)", v->num);
+			}
+		break;
+		case LVAL_SYM:
+			lbuf_printf(b, "lval_sym(");
+			lemit_str(b, v->sym);
+			lbuf_printf(b, ")");
+		break;
+		case LVAL_SEXPR:
+		case LVAL_QEXPR:
+			for(int i = 0; i < v->count; i++) { lbuf_printf(b, "lval_add("); }
+			lbuf_printf(b, v->type == LVAL_SEXPR ? "lval_sexpr()" : "lval_qexpr()");
+			for(int i = 0; i < v->count; i++){
+				lbuf_printf(b, ", ");
+				lemit_lval(b, LPTR(v->cell[i]));
+				lbuf_printf(b, ")");
+			}
+		break;
+		default:
+			//only errors from the reader are left, such as bad numbers
+			lbuf_printf(b, "lval_err(\"%%s\", ");
+			lemit_str(b, v->type == LVAL_ERR ? v->err : "cannot compile value");
+			lbuf_printf(b, ")");
+		break;
+	}
+}
+
+//compile (\ {formals} {body}) bound to name into fns, and the call that
+//installs it into main. Lambdas that do not type stay interpreted
+void lemit_lambda(lfold* st, lval* name, lval* v, int id, lbuf* fns, lbuf* top){
+	lval* formals = LPTR(v->cell[1]);
+	if(formals->type != LVAL_QEXPR) { return; }
+	for(int i = 0; i < formals->count; i++){
+		if(LPTR(formals->cell[i])->type != LVAL_SYM) { return; }
+	}
+
+	linfer x = { NULL, st, NULL, lval_copy(formals), formals->count, lval_qexpr(), lval_qexpr(), name, v };
+	lint* n = linfer_quoted(&x, LPTR(v->cell[2]));
+
+	if(n){
+		lbuf body = { NULL, 0, 0 };
+		lcgen g = { &body, 0, 0, 1, id, x.slots > 0 ? x.slots : 1 };
+		int t = lcgen_node(&g, n);
+		lbuf_printf(fns, "//%s\nstatic long rl_fn_%d(long* slots, int* fail){\n", name->sym, id);
+		lbuf_printf(fns, "%s\treturn t%d;\n", body.s, t);
+		if(g.fails) { lbuf_printf(fns, "fail:\n\t*fail = 1;\n\treturn 0;\n"); }
+		lbuf_printf(fns, "}\n\n");
+		free(body.s);
+		lint_del(n);
+
+		lbuf_printf(top, "\tlcode_install(e, ");
+		lemit_str(top, name->sym);
+		lbuf_printf(top, ", rl_fn_%d, %d, ", id, x.slots);
+		lemit_lval(top, x.guards);
+		lbuf_printf(top, ");\n");
+	}
+
+	lval_delete(x.scope);
+	lval_delete(x.guards);
+	lval_delete(x.vars);
+}
+
+//--emit-c: translate a program into a C file that builds each top level
+//form directly and evaluates it, with numeric lambdas as C functions.
+//The result links against this file built with -DRYLISP_NO_MAIN
+void lemit_c(lenv* e, lval* prog, char* path, FILE* out){
+	lbuf fns = { NULL, 0, 0 };
+	lbuf top = { NULL, 0, 0 };
+	lfold* st = lfold_new(e, prog, 1);
+	int id = 0;
+
+	while(prog->count){
+		lval* x = lfold_form(st, lval_pop(prog, 0));
+		lbuf_printf(&top, "\tlval_run(e, ");
+		lemit_lval(&top, x);
+		lbuf_printf(&top, ");\n");
+
+		//define lambdas now as well, so later forms fold and inline
+		//against them the way they would when the file is run. With def
+		//and \\ never rebound, such a form cannot fail
+		if(x->type == LVAL_SEXPR && x->count > 2 && lfold_builtin(st, LPTR(x->cell[0])) == builtin_def
+			&& LPTR(x->cell[1])->type == LVAL_QEXPR && LPTR(x->cell[1])->count == x->count - 2){
+			int lambdas = 1;
+			for(int i = 2; i < x->count; i++){
+				lval* v = LPTR(x->cell[i]);
+				if(v->type != LVAL_SEXPR || v->count != 3
+					|| lfold_builtin(st, LPTR(v->cell[0])) != builtin_lambda) { lambdas = 0; }
+			}
+			if(lambdas){
+				lval_delete(lval_eval(e, lval_copy(x)));
+				for(int i = 2; i < x->count; i++){
+					lemit_lambda(st, LPTR(LPTR(x->cell[1])->cell[i - 2]), LPTR(x->cell[i]), id++, &fns, &top);
+				}
+			}
+		}
+		lval_delete(x);
+	}
+	lfold_del(st);
+
+	fprintf(out, "//generated by rylisp --emit-c from %s\n", path);
+	fprintf(out, "//build: cc -std=c99 -DRYLISP_NO_MAIN -I. this.c parsing.c mpc.c -ledit -lm\n\n");
+	fprintf(out, "#include <limits.h>\n#include \"declarations.h\"\n\n");
+	if(fns.s) { fputs(fns.s, out); }
+	fprintf(out, "int main(void){\n\tlenv* e = lenv_new();\n\tlenv_add_builtins(e);\n\n");
+	if(top.s) { fputs(top.s, out); }
+	fprintf(out, "\n\tlenv_del(e);\n\treturn 0;\n}\n");
+
+	free(fns.s);
+	free(top.s);
+}
+
 void lenv_add_builtin(lenv* e, char* name, lbuiltin func){
 	lval* k = lval_sym(name);
-	lval* v = lval_fun(func);
-	lenv_put(e, k, v);
-	//delete these, since the environment copies them
+	lenv_move(e, k, lval_fun(func));
 	lval_delete(k);
-	lval_delete(v);
 }
 
 void lenv_add_builtins(lenv* e){
+	//special forms
+	for(int i = 0; lspecials[i].name; i++){
+		lspecials[i].name = lsym_intern(lspecials[i].name);
+	}
+
 	//variable functions
 	lenv_add_builtin(e, "\\", builtin_lambda);
 	lenv_add_builtin(e, "def", builtin_def);
@@ -581,6 +3755,18 @@ void lenv_add_builtins(lenv* e){
 	lenv_add_builtin(e, "-", builtin_sub);
 	lenv_add_builtin(e, "*", builtin_mul);
 	lenv_add_builtin(e, "/", builtin_div);
+
+	//comparison functions
+	lenv_add_builtin(e, "if", builtin_if);
+	lenv_add_builtin(e, "==", builtin_eq);
+	lenv_add_builtin(e, "!=", builtin_ne);
+	lenv_add_builtin(e, ">", builtin_gt);
+	lenv_add_builtin(e, "<", builtin_lt);
+	lenv_add_builtin(e, ">=", builtin_ge);
+	lenv_add_builtin(e, "<=", builtin_le);
+
+	//loops
+	lenv_add_builtin(e, "recur", builtin_recur);
 }
 
 char* ltype_name(int t){
@@ -591,23 +3777,23 @@ char* ltype_name(int t){
 		case LVAL_SYM: return "Symbol";
 		case LVAL_SEXPR: return "S-Expression";
 		case LVAL_QEXPR: return "Q-Expression";
+		case LVAL_RECUR: return "Recur";
 		default: return "Unknown";
 	}
 }
 
 lval* lval_pop(lval* v, int i){
+	lval_own(v);
+
 	//find item at i
-	lval* x = v->cell[i];
+	lval* x = LPTR(v->cell[i]);
 
 	//shift memory after item i over the top
 	memmove(&v->cell[i], &v->cell[i+1],
-		sizeof(lval*) * (v->count-i-1));
+		sizeof(lref) * (v->count-i-1));
 
-	//decrease the count of items in the list
+	//decrease the count of items in the list, keeping the capacity
 	v->count--;
-
-	//reallocate the memory used
-	v->cell = realloc(v->cell, sizeof(lval*) * v->count);
 	return x;
 }
 
@@ -617,15 +3803,210 @@ lval* lval_take(lval* v, int i){
 	return x;
 }
 
+//whether lval_eval_num can take v: only numbers, variables, arithmetic,
+//comparisons, inlined calls and calls to typed lambdas qualify. Returns 0
+//when v does not with the bindings e has now, and LNUM_NEVER when it
+//cannot whatever they are, which a list keeps so that it is not looked at
+//again. Nothing is evaluated, so a no leaves nothing to redo
+#define LNUM_NEVER -1
+int lval_num_ok(lenv* e, lval* v){
+	if(v->type == LVAL_NUM) { return 1; }
+	if(v->type == LVAL_SYM){
+		lval* x = lenv_lookup(e, v->sym);
+		return x && x->type == LVAL_NUM;
+	}
+	if(v->type != LVAL_SEXPR) { return LNUM_NEVER; }
+	if(v->num == LNUM_NEVER) { return LNUM_NEVER; }
+	if(v->count == 0) { goto never; }
+	if(v->count == 1){
+		int r = lval_num_ok(e, LPTR(v->cell[0]));
+		if(r == LNUM_NEVER) { goto never; }
+		return r;
+	}
+	if(LPTR(v->cell[0])->type != LVAL_SYM) { goto never; }
+
+	if(lval_is_inline(v)){
+		lval* f = lenv_lookup(e, LPTR(v->cell[1])->sym);
+		if(!f || f->type != LVAL_FUN || f->builtin || f->env->count != 0
+			|| !lval_eq(f->formals, LPTR(v->cell[2])) || !lval_eq(f->body, LPTR(v->cell[3]))) { return 0; }
+		LPTR(v->cell[4])->type = LVAL_SEXPR;
+		int r = lval_num_ok(e, LPTR(v->cell[4]));
+		LPTR(v->cell[4])->type = LVAL_QEXPR;
+		if(r == LNUM_NEVER) { goto never; }
+		return r;
+	}
+	if(lval_special(v)) { goto never; }
+
+	lval* f = lenv_lookup(e, LPTR(v->cell[0])->sym);
+	if(!f || f->type != LVAL_FUN) { return 0; }
+	lbuiltin b = f->builtin;
+	if(b){
+		int arith = b == builtin_add || b == builtin_sub || b == builtin_mul || b == builtin_div;
+		int cmp = b == builtin_gt || b == builtin_lt || b == builtin_ge || b == builtin_le
+			|| b == builtin_eq || b == builtin_ne;
+		if(!arith && !(cmp && v->count == 3)) { return 0; }
+	} else {
+		lcode* c = f->code;
+		if((c->state != LJIT_TYPED && c->state != LJIT_NATIVE)
+			|| f->env->count != 0 || f->formals->count != v->count - 1) { return 0; }
+		long slots[c->slots];
+		if(!ljit_guard(c, e, slots)) { return 0; }
+	}
+
+	int ok = 1;
+	for(int i = 1; i < v->count; i++){
+		int r = lval_num_ok(e, LPTR(v->cell[i]));
+		if(r == LNUM_NEVER) { goto never; }
+		if(!r) { ok = 0; }
+	}
+	return ok;
+
+	never:
+	v->num = LNUM_NEVER;
+	return LNUM_NEVER;
+}
+
+//apply f to the numbers in args through the interpreter, for the calls
+//lval_eval_num cannot finish unboxed. Typed code already failed when typed
+//is set, so the lambda's body is evaluated directly
+lval* lval_num_call(lenv* e, lval* f, long* args, int n, int typed){
+	lval* a = lval_sexpr();
+	for(int i = 0; i < n; i++) { lval_add(a, lval_num(args[i])); }
+	return typed ? lval_apply(e, lval_copy(f), a) : lval_call(e, lval_copy(f), a);
+}
+
+//evaluate an expression lval_num_ok has accepted without boxing anything:
+//operands and intermediate results live in stack slots of this frame and
+//never escape it. Returns NULL with the number in *out, or the value of v
+//when that is not a number, such as the error of a division by zero. It
+//never gives up partway, since what it has run would have to run again
+lval* lval_eval_num(lenv* e, lval* v, long* out){
+	if(v->type == LVAL_NUM){
+		*out = v->num;
+		return NULL;
+	}
+	if(v->type == LVAL_SYM){
+		*out = lenv_lookup(e, v->sym)->num;
+		return NULL;
+	}
+	//lval_num_ok took no empty lists
+	int n = v->count;
+	if(n < 2) { return lval_eval_num(e, LPTR(v->cell[0]), out); }
+
+	if(lval_is_inline(v)){
+		LPTR(v->cell[4])->type = LVAL_SEXPR;
+		lval* r = lval_eval_num(e, LPTR(v->cell[4]), out);
+		LPTR(v->cell[4])->type = LVAL_QEXPR;
+		return r;
+	}
+
+	lval* f = lenv_lookup(e, LPTR(v->cell[0])->sym);
+	lbuiltin b = f->builtin;
+
+	//arguments in order. One that is not a number, which only the
+	//interpreter can produce, leaves the call to the interpreter as well
+	long args[n];
+	for(int i = 1; i < n; i++){
+		lval* r = lval_eval_num(e, LPTR(v->cell[i]), &args[i]);
+		if(!r) { continue; }
+		r = lval_recur_check(r);
+		if(r->type == LVAL_ERR) { return r; }
+
+		lval* a = lval_sexpr();
+		for(int j = 1; j < i; j++) { lval_add(a, lval_num(args[j])); }
+		lval_add(a, r);
+		for(int j = i + 1; j < n; j++){
+			long x;
+			r = lval_eval_num(e, LPTR(v->cell[j]), &x);
+			if(r) { r = lval_recur_check(r); }
+			if(r && r->type == LVAL_ERR){
+				lval_delete(a);
+				return r;
+			}
+			lval_add(a, r ? r : lval_num(x));
+		}
+		return lval_call(e, lval_copy(f), a);
+	}
+
+	lval* r = NULL;
+	if(!b){
+		//a typed lambda takes its arguments straight into its slots. Typed
+		//code run before this may have deopted it since lval_num_ok
+		lcode* c = f->code;
+		int ran = 0;
+		if(c->state == LJIT_TYPED || c->state == LJIT_NATIVE){
+			lcode_enter(c, f, e);
+			long slots[c->slots];
+			memcpy(slots, args + 1, sizeof(long) * (n - 1));
+			if(ljit_guard(c, e, slots)){
+				int fail = 0;
+				*out = lcode_run(c, slots, &fail);
+				if(!fail) { return NULL; }
+				ran = 1;
+			}
+		}
+		r = lval_num_call(e, f, args + 1, n - 1, ran);
+	} else {
+		//the same operations as builtin_op and builtin_ord
+		long x = args[1];
+		if(b == builtin_sub && n == 2) { x = -x; }
+		for(int i = 2; i < n; i++){
+			if(b == builtin_add) { x += args[i]; }
+			if(b == builtin_sub) { x -= args[i]; }
+			if(b == builtin_mul) { x *= args[i]; }
+			if(b == builtin_div){
+				//leave the error to builtin_op
+				if(args[i] == 0){
+					r = lval_num_call(e, f, args + 1, n - 1, 0);
+					break;
+				}
+				x /= args[i];
+			}
+		}
+		if(b == builtin_gt) { x = args[1] > args[2]; }
+		if(b == builtin_lt) { x = args[1] < args[2]; }
+		if(b == builtin_ge) { x = args[1] >= args[2]; }
+		if(b == builtin_le) { x = args[1] <= args[2]; }
+		if(b == builtin_eq) { x = args[1] == args[2]; }
+		if(b == builtin_ne) { x = args[1] != args[2]; }
+		*out = x;
+		if(!r) { return NULL; }
+	}
+
+	if(r->type != LVAL_NUM) { return r; }
+	*out = r->num;
+	lval_delete(r);
+	return NULL;
+}
+
 lval* lval_eval_sexpr(lenv* e, lval* v){
-	//eval children
+	//special forms see their arguments before evaluation
+	if(v->count > 1 && LPTR(v->cell[0])->type == LVAL_SYM){
+		lbuiltin form = lval_special(v);
+		if(form) {
+			lval_own(v);
+			return form(e, v);
+		}
+	}
+
+	//numeric expressions need no argument lists, only their result is boxed
+	if(lval_num_ok(e, v) == 1){
+		long n;
+		lval* r = lval_eval_num(e, v, &n);
+		lval_delete(v);
+		return r ? r : lval_num(n);
+	}
+
+	//eval children, in place once the cells are v's own
+	lval_own(v);
 	for(int i = 0; i < v->count; i++){
-		v->cell[i] = lval_eval(e, v->cell[i]);
+		v->cell[i] = LREF(lval_eval(e, LPTR(v->cell[i])));
 	}
 
-	//check for errors
+	//check for errors, counting a recur passed as an argument as one
 	for(int i = 0; i < v->count; i++){
-		if(v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+		if(v->count > 1) { v->cell[i] = LREF(lval_recur_check(LPTR(v->cell[i]))); }
+		if(LPTR(v->cell[i])->type == LVAL_ERR) { return lval_take(v, i); }
 	}
 
 	//empty expression
@@ -650,9 +4031,7 @@ lval* lval_eval_sexpr(lenv* e, lval* v){
 		return err;
 	}
 
-	lval* result = lval_call(e, f, v);
-	lval_delete(f);
-	return result;
+	return lval_call(e, f, v);
 }
 
 lval* lval_eval(lenv* e, lval* v){
@@ -674,6 +4053,7 @@ lenv* lenv_new(void){
 	lenv* e = malloc(sizeof(lenv));
 	e->par = NULL;
 	e->count = 0;
+	e->frame = LENV_HEAP;
 	e->syms = NULL;
 	e->vals = NULL;
 	return e;
@@ -681,8 +4061,7 @@ lenv* lenv_new(void){
 
 void lenv_del(lenv* e){
 	for(int i = 0; i < e->count; i++){
-		free(e->syms[i]);
-		lval_delete(e->vals[i]);
+		lval_delete(LPTR(e->vals[i]));
 	}
 	free(e->syms);
 	free(e->vals);
@@ -690,57 +4069,118 @@ void lenv_del(lenv* e){
 }
 
 lval* lenv_get(lenv* e, lval* k){
-	//iterate over all elements in environment
-	for(int i = 0; i < e->count; i++){
-		//check if the stored string matches the symbol string
+	//walk out through the parents
+	for(; e; e = e->par){
+		//symbols are interned, so a pointer compare finds the name
 		//if it does, return a copy of the value
-		if(strcmp(e->syms[i], k->sym) == 0){
-			return lval_copy(e->vals[i]);
+		for(int i = 0; i < e->count; i++){
+			if(e->syms[i] == k->sym){
+				return lval_copy(LPTR(e->vals[i]));
+			}
 		}
 	}
-	//if no symbol, check in parent, otherwise error
+	return lval_err("Unbound symbol '%s'", k->sym);
+}
 
-	if(e->par){
-		return lenv_get(e->par, k);
-	} else {
-		return lval_err("Unbound symbol '%s'", k->sym);
+//find the value bound to a symbol without copying it, or NULL
+lval* lenv_lookup(lenv* e, char* sym){
+	for(; e; e = e->par){
+		for(int i = 0; i < e->count; i++){
+			if(e->syms[i] == sym) { return LPTR(e->vals[i]); }
+		}
+	}
+	return NULL;
+}
+
+//find the value bound to a symbol in e itself, not its parents, or NULL
+lval* lenv_lookup_frame(lenv* e, char* sym){
+	for(int i = 0; i < e->count; i++){
+		if(e->syms[i] == sym) { return LPTR(e->vals[i]); }
 	}
+	return NULL;
 }
 
+//bind k to a copy of v
 void lenv_put(lenv* e, lval* k, lval* v){
+	//global bindings are promoted out of the open region
+	lenv_move(e, k, e == lregion_root ? lval_promote(v) : lval_copy(v));
+}
+
+//bind k to v, taking ownership of v so no copy is made
+void lenv_move(lenv* e, lval* k, lval* v){
+	//a value bound globally must outlive the open region
+	if(e == lregion_root && v->region){
+		lval* x = lval_promote(v);
+		lval_delete(v);
+		v = x;
+	}
+
 	//iterate over elements in environment 
 	//to see if variable already exists
 	for(int i = 0; i < e->count; i++){
 		//if found, delete item at that position
 		//and replace with given variable
-		if(strcmp(e->syms[i], k->sym) == 0){
-			lval_delete(e->vals[i]);
-			e->vals[i] = lval_copy(v);
+		if(e->syms[i] == k->sym){
+			lval_delete(LPTR(e->vals[i]));
+			e->vals[i] = LREF(v);
 			return;
 		}
 	}
 
+	//loop frames only hold their own bindings, anything else goes outward
+	if(e->frame == LENV_LOOP){
+		lenv_move(e->par, k, v);
+		return;
+	}
+
+	//a let frame has no room to grow, so move it to the heap first
+	if(e->frame == LENV_LET){
+		lenv_unframe(e);
+	}
+
 	//if no existing entry found, allocate space for new entry
 	e->count++;
-	e->vals = realloc(e->vals, sizeof(lval*) * e->count);
+	e->vals = realloc(e->vals, sizeof(lref) * e->count);
 	e->syms = realloc(e->syms, sizeof(char*) * e->count);
 
-	//copy contents of lval and symbol string into new location
-	e->vals[e->count - 1] = lval_copy(v);
-	e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-	strcpy(e->syms[e->count-1], k->sym);
+	//store the lval in the new location, the name is interned
+	e->vals[e->count - 1] = LREF(v);
+	e->syms[e->count - 1] = k->sym;
+}
+
+//move the bindings of a let frame into heap storage owned by e
+void lenv_unframe(lenv* e){
+	char** syms = malloc(sizeof(char*) * e->count);
+	lref* vals = malloc(sizeof(lref) * e->count);
+	memcpy(syms, e->syms, sizeof(char*) * e->count);
+	memcpy(vals, e->vals, sizeof(lref) * e->count);
+	e->syms = syms;
+	e->vals = vals;
+	e->frame = LENV_HEAP;
+}
+
+//release the bindings of a let frame. The frame itself lives on the
+//C stack, so only the values (and any spilled storage) need freeing
+void lenv_frame_release(lenv* e){
+	for(int i = 0; i < e->count; i++){
+		lval_delete(LPTR(e->vals[i]));
+	}
+	if(e->frame == LENV_HEAP){
+		free(e->syms);
+		free(e->vals);
+	}
 }
 
 lenv* lenv_copy(lenv* e){
 	lenv* n = malloc(sizeof(lenv));
 	n->par = e->par;
 	n->count = e->count;
+	n->frame = LENV_HEAP;
 	n->syms = malloc(sizeof(char*) * n->count);
-	n->vals = malloc(sizeof(lval*) * n->count);
+	n->vals = malloc(sizeof(lref) * n->count);
+	if(n->count) { memcpy(n->syms, e->syms, sizeof(char*) * n->count); }
 	for(int i = 0; i < e->count; i++){
-		n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-		strcpy(n->syms[i], e->syms[i]);
-		n->vals[i] = lval_copy(e->vals[i]);
+		n->vals[i] = LREF(lval_copy(LPTR(e->vals[i])));
 	}
 
 	return n;
@@ -754,6 +4194,117 @@ void lenv_def(lenv* e, lval* k, lval* v){
 	lenv_put(e, k, v);
 }
 
+//define globally, taking ownership of v
+void lenv_def_move(lenv* e, lval* k, lval* v){
+	while(e->par) { e = e->par; }
+	lenv_move(e, k, v);
+	//global data is shared with any equal data once it is on the heap
+	if(lcons_enabled) { lval_cons(lenv_lookup(e, k->sym)); }
+}
+
+//evaluate a top level form from a file, printing only errors
+void lval_run(lenv* e, lval* x){
+	x = lval_eval(e, x);
+	if(x->type == LVAL_ERR) { lval_println(x); }
+	lval_delete(x);
+}
+
+//read the program with an mpc grammar instead of lval_read_text: 1 for
+//the combinator grammar that folds straight to lvals, 2 for the mpca_lang
+//grammar through an AST and lval_read
+static int lread_mpc = 0;
+
+//the AST of each parse is built in this arena and released in one go
+//once it has been read
+static mpc_ast_arena_t* lread_arena = NULL;
+
+//parse the n bytes of input with an mpc grammar, in place, printing any
+//syntax error and returning NULL
+lval* lval_parse_mpc(char* name, char* input, size_t n, mpc_parser_t* grammar){
+	if(lread_mpc == 2 && !lread_arena) { lread_arena = mpc_ast_arena_new(); }
+	mpc_result_t r;
+	int ok = mpc_parse_arena(name, input, n, grammar, &r, lread_mpc == 2 ? lread_arena : NULL);
+	if(!ok){
+		mpc_err_print(r.error);
+		mpc_err_delete(r.error);
+		if(lread_arena) { mpc_ast_arena_clear(lread_arena); }
+		return NULL;
+	}
+	if(lread_mpc == 1) { return r.output; }
+	lval* x = lval_read(r.output);
+	mpc_ast_arena_clear(lread_arena);
+	return x;
+}
+
+//release what reading with the mpc grammars keeps between parses
+void lread_cleanup(void){
+	if(lread_arena) { mpc_ast_arena_delete(lread_arena); }
+	lread_arena = NULL;
+	mpc_ast_tags_cleanup();
+	ltag_number = -1;
+}
+
+//parse input into an s-expression of its forms, printing any syntax error
+//and returning NULL
+lval* lval_parse(char* name, char* input, mpc_parser_t* grammar){
+	if(lread_mpc) { return lval_parse_mpc(name, input, strlen(input), grammar); }
+
+	char* err;
+	lval* x = lval_read_text(name, input, &err);
+	if(!x){
+		fputs(err, stdout);
+		free(err);
+	}
+	return x;
+}
+
+//the whole of a file as a string, or NULL if it can't be read
+char* lread_file(char* path){
+	FILE* f = fopen(path, "rb");
+	if(!f) { return NULL; }
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char* s = NULL;
+	if(n >= 0){
+		s = malloc(n + 1);
+		n = fread(s, 1, n, f);
+		s[n] = '\0';
+	}
+	fclose(f);
+	return s;
+}
+
+//parse a file, printing any error. The mpc readers take a length, so
+//regular files are mapped and parsed where they lie rather than read
+//into a second copy
+lval* lval_parse_file(char* path, mpc_parser_t* grammar){
+	if(lread_mpc){
+		int fd = open(path, O_RDONLY);
+		struct stat st;
+		if(fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)){
+			size_t n = st.st_size;
+			char* input = n ? mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+			close(fd);
+			if(input != MAP_FAILED){
+				lval* x = lval_parse_mpc(path, input, n, grammar);
+				if(n) { munmap(input, n); }
+				return x;
+			}
+		} else if(fd >= 0) { close(fd); }
+	}
+
+	char* input = lread_file(path);
+	if(!input){
+		printf("%s: error: Unable to open file!\n", path);
+		return NULL;
+	}
+	lval* x = lval_parse(path, input, grammar);
+	free(input);
+	return x;
+}
+
+#ifndef RYLISP_NO_MAIN
 int main(int argc, char** argv){
 	//Make some parsers
 	mpc_parser_t* Number 	= mpc_new("number");
@@ -775,31 +4326,117 @@ int main(int argc, char** argv){
 		",
 	Number, Symbol, Sexpr, Qexpr, Expr, RyLisp);
 
-	puts("RyLisp Version 0.0.0.0.0.0.1");
-	puts("Press Ctrl-C to Exit\n");
+	//the same grammar from combinators, folding to lvals as it goes
+	mpc_parser_t* FExpr     = mpc_new("expr");
+	mpc_parser_t* FSexpr    = mpc_new("sexpr");
+	mpc_parser_t* FQexpr    = mpc_new("qexpr");
+	mpc_parser_t* FRyLisp   = mpc_new("rylisp");
+
+	//only what fails before consuming anything is named "expression", so an
+	//unclosed list still reports the bracket it expects
+	mpc_define(FSexpr, mpc_and(3, lread_fold_sexpr,
+		mpc_expect(mpc_tok(mpc_char('(')), "expression"), mpc_many(lread_fold_list, FExpr), mpc_tok(mpc_char(')')),
+		free, lread_fold_del));
+	mpc_define(FQexpr, mpc_and(3, lread_fold_qexpr,
+		mpc_expect(mpc_tok(mpc_char('{')), "expression"), mpc_many(lread_fold_list, FExpr), mpc_tok(mpc_char('}')),
+		free, lread_fold_del));
+	mpc_define(FExpr, mpc_or(3,
+		mpc_expect(mpc_or(2,
+			mpc_apply(mpc_tok(mpc_span(mpc_re("-?[0-9]+"))), lread_fold_num),
+			mpc_apply(mpc_tok(mpc_span(mpc_re("[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+"))), lread_fold_sym)), "expression"),
+		FSexpr, FQexpr));
+	mpc_define(FRyLisp, mpc_whole(mpc_and(2, mpcf_snd,
+		mpc_blank(), mpc_many(lread_fold_list, FExpr),
+		mpcf_dtor_null), lread_fold_del));
+	//flatten the combinators above into fewer, larger parsers
+	mpc_optimise(FSexpr);
+	mpc_optimise(FQexpr);
+	mpc_optimise(FExpr);
+	mpc_optimise(FRyLisp);
 
 	lenv* e = lenv_new();
 	lenv_add_builtins(e);
 
+	//leading options: --hash-cons shares the storage of equal quoted data,
+	//see lcons_cells, and --mpc or --mpc-ast read source with the grammars
+	//above
+	while(argc >= 2){
+		if(strcmp(argv[1], "--hash-cons") == 0){
+			lcons_enabled = 1;
+		} else if(strcmp(argv[1], "--mpc") == 0){
+			lread_mpc = 1;
+		} else if(strcmp(argv[1], "--mpc-ast") == 0){
+			lread_mpc = 2;
+		} else {
+			break;
+		}
+		argc--;
+		argv++;
+	}
+	mpc_parser_t* grammar = lread_mpc == 2 ? RyLisp : FRyLisp;
+
+	//compile a file to C instead of running it
+	if(argc == 3 && strcmp(argv[1], "--emit-c") == 0){
+		lval* prog = lval_parse_file(argv[2], grammar);
+		int ok = prog != NULL;
+		if(ok){
+			prog = lval_expand_program(prog);
+			lemit_c(e, prog, argv[2], stdout);
+			lval_delete(prog);
+		}
+		lenv_del(e);
+		mpc_cleanup(10, Number, Symbol, Sexpr, Qexpr, Expr, RyLisp,
+			FExpr, FSexpr, FQexpr, FRyLisp);
+		lread_cleanup();
+		return ok ? 0 : 1;
+	}
+
+	//run any files given on the command line, one top level form at a time
+	if(argc >= 2){
+		for(int i = 1; i < argc; i++){
+			lval* prog = lval_parse_file(argv[i], grammar);
+			if(!prog) { continue; }
+
+			//a file is the whole program unless others share its environment
+			prog = lval_expand_program(prog);
+			lfold* st = lfold_new(e, prog, argc == 2);
+
+			while(prog->count){
+				lval_run(e, lfold_form(st, lval_pop(prog, 0)));
+			}
+			lfold_del(st);
+			lval_delete(prog);
+		}
+		lenv_del(e);
+		mpc_cleanup(10, Number, Symbol, Sexpr, Qexpr, Expr, RyLisp,
+			FExpr, FSexpr, FQexpr, FRyLisp);
+		lread_cleanup();
+		return 0;
+	}
+
+	puts("RyLisp Version 0.0.0.0.0.0.1");
+	puts("Press Ctrl-C to Exit\n");
+
 	while(1){
-		//display prompt and read input
+		//display prompt and read input, stopping at end of input
 		char* input = readline("RyLisp> ");
+		if(!input){
+			putchar('\n');
+			break;
+		}
 
 		//add to history
 		add_history(input);
 
-		//try to parse it
-		mpc_result_t r;
-		if(mpc_parse("<stdin>", input, RyLisp, &r)){
-			//evaluate the AST and print the result
-			lval *result = lval_eval(e, lval_read(r.output));
+		//parse, evaluate and print the result. Everything the form
+		//allocated, the result included, goes with its region
+		lregion_begin(e);
+		lval* prog = lval_parse("<stdin>", input, grammar);
+		if(prog){
+			lval *result = lval_eval(e, lval_fold(e, lval_expand(prog)));
 			lval_println(result);
-			lval_delete(result);
-			mpc_ast_delete(r.output);
-		} else {
-			mpc_err_print(r.error);
-			mpc_err_delete(r.error);
 		}
+		lregion_end();
 		//echo it back out
 		//printf("You said %s\n", input);
 
@@ -807,6 +4444,10 @@ int main(int argc, char** argv){
 		free(input);
 	}
 
-	mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, RyLisp);
+	lenv_del(e);
+	mpc_cleanup(10, Number, Symbol, Sexpr, Qexpr, Expr, RyLisp,
+		FExpr, FSexpr, FQexpr, FRyLisp);
+	lread_cleanup();
 	return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,29 @@
+(def {g} (\ {n} {if (< n 1) {0} {+ 1 (g (- n 1))}}))
+(def {w} (\ {n} {if (< n 1) {0} {+ 1 (w (- n 1))}}))
+(def {f} (\ {n} {if (< n -1) {f n} {+ (w 300) (g 5)}}))
+(g 1)
+(g 2)
+(g 3)
+(w 1)
+(w 2)
+(w 3)
+(f 1)
+(f 2)
+(f 3)
+(def {bad} (\ {+} {g 1}))
+(bad head)
+(g 1)
+(g 1)
+(bad head)
+(g 1)
+(g 1)
+(bad head)
+(g 1)
+(g 1)
+(bad head)
+(g 1)
+(g 1)
+(bad head)
+(def {spin} (\ {n} {if (== n 0) {0} {spin (- (+ n (f n) (- 0 (f n))) 1)}}))
+(spin 300)
+(f 5)
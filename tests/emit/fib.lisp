@@ -0,0 +1,7 @@
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(def {sum} (\ {n acc} {if (== n 0) {acc} {sum (- n 1) (+ acc n)}}))
+(if (== (fib 20) 6765) {fib-ok} {fib-wrong})
+(if (== (sum 1000 0) 500500) {sum-ok} {sum-wrong})
+(fib {1})
+(def {fib} (\ {n} {* n 2}))
+(if (== (fib 20) 40) {redef-ok} {redef-wrong})
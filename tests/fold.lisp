@@ -0,0 +1,15 @@
+(+)
+(def {g} (\ {x} {(+)}))
+(g 1)
+(- 5)
+(+ 1 (* 2 3))
+(/ 1 0)
+(if (> 2 1) {1} {2})
+(def {k} (\ {x} {+ x (- 10 4)}))
+(k 1)
+(def {f} (\ {x} {+ 1 2}))
+(def {+} -)
+(f 0)
+(def {g} (\ {x} {if 1 {10} {20}}))
+(def {if} (\ {c a b} {eval b}))
+(g 0)
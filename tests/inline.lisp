@@ -0,0 +1,25 @@
+(def {h} (\ {c y} {if c {y} {0}}))
+(h 0 nosuch)
+(h 1 nosuch)
+(def {x} 7)
+(def {k} (\ {} {x}))
+(k)
+((\ {} {x}))
+(def {sq} (\ {a} {* a a}))
+(def {y} 5)
+(sq y)
+(sq nosuch)
+(def {g} (\ {a b} {- b a}))
+(g nosuch other)
+(g y 1)
+(def {d} (\ {a b} {+ (/ 1 a) b}))
+(d 0 nosuch)
+(d 1 y)
+(def {f} (\ {n} {+ (sq n) (h n n)}))
+(f y)
+(f 0)
+(def {getx} (\ {u} {+ x u}))
+(def {outer} (\ {x} {getx 1}))
+(outer 5)
+(def {app} (\ {x} {sq 3}))
+(app 7)
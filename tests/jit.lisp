@@ -0,0 +1,17 @@
+(def {k} 1)
+(def {addk} (\ {x} {+ x k}))
+(def {sumk} (\ {n} {loop {{i 0} {s 0}} (if (== i n) {s} {recur (+ i 1) (+ s (addk i))})}))
+(sumk 150)
+(sumk 3)
+(def {k} {1})
+(sumk 3)
+(def {k} 2)
+(sumk 3)
+(def {quot} (\ {x y} {/ x y}))
+(def {sumq} (\ {x n} {loop {{i 1} {s 0}} (if (> i n) {s} {recur (+ i 1) (+ s (quot x i))})}))
+(sumq 1000 150)
+(sumq 1000 0)
+(def {divs} (\ {x n} {loop {{i n} {s 0}} (if (< i 0) {s} {recur (- i 1) (+ s (quot x i))})}))
+(divs 1000 3)
+(divs {1000} 3)
+(sumq 1000 3)
@@ -0,0 +1,10 @@
+(let {{x 1} {y 2}} (+ x y))
+(let* {{x 1} {y (+ x 1)}} (* x y))
+(letrec {{f (\ {n} {if (== n 0) {1} {* n (f (- n 1))}})}} (f 5))
+(let* {{x 1} {x (+ x 1)}} x)
+(let {{x 1} {x 5}} x)
+(letrec {{x 1} {x 3}} x)
+(def {dup} (\ {a} {let* {{x a} {x (+ x 1)}} x}))
+(dup 1)
+(dotimes {i 300} (dup 1))
+(dup 1)
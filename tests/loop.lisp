@@ -0,0 +1,20 @@
+(def {n} 0)
+(while (< n 10) (= {n} (+ n 1)))
+n
+(def {acc} 0)
+(dotimes {i 100} (= {acc} (+ acc i)))
+acc
+(loop {{i 0} {s 0}} (if (== i 1000) {s} {recur (+ i 1) (+ s i)}))
+(loop {{l {1 2 3}} {r {}}} (if (== l {}) {r} {recur (tail l) (join (head l) r)}))
+(recur 1)
+(while 1 (nosuch))
+(dotimes {i {1}} 1)
+(list (== 1 1) (!= 1 1) (< 1 2) (> 1 2) (<= 2 2) (>= 1 2))
+(== {a {b}} {a {b}})
+(if 0 {1} {2})
+(if 1 {1})
+(loop {{i 0}} (list (recur 1)))
+(loop {{i 0}} (+ 1 (recur 1)))
+(loop {{i 0}} (recur 1) 5)
+(loop {{i 0}} (let {{x (recur 1)}} x))
+(loop {{i 0}} (let {{x 1}} (if (== i 3) {i} {recur (+ i 1)})))
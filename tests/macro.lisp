@@ -0,0 +1,29 @@
+(defmacro {unless c a b} {if c {b} {a}})
+(unless 0 1 2)
+(unless 1 1 2)
+(def {f} (\ {x} {unless x 10 20}))
+(f 0)
+(f 1)
+(def {unless} 5)
+((\ {unless} {unless}) 7)
+(head {unless 0 5})
+{unless 0 5}
+(let {{unless 3}} unless)
+(let {{y (unless 1 2 3)}} y)
+(let* {{unless 3} {z unless}} z)
+(dotimes {unless 2} unless)
+(if 1 {unless 0 1 2} {0})
+(defmacro {twice x} {+ x x})
+(twice (twice 3))
+((\ {twice} {twice}) 4)
+(defmacro {swap-sub a b} {let {{t a}} (- b t)})
+(def {t} 100)
+(swap-sub t 1)
+(unless 1 2)
+(defmacro {forever x} {forever x})
+(forever 1)
+(defmacro {my-inc x} {+ x 1})
+(eval {my-inc 3})
+(eval (join {my-inc} {3}))
+(let {{my-inc 5}} (eval {my-inc}))
+(let {{+ -}} (my-inc 5))
@@ -0,0 +1,119 @@
+/*
+** Each parse builds its AST in the arena it is
+** given, even a parse run from a callback of
+** another, and copies leave the arena.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("arena.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static mpc_parser_t *Lisp;
+static mpc_ast_arena_t *inner;
+static mpc_ast_t *nested;
+
+/* Walks a tree and checks every node is in arena r */
+static int in_arena(mpc_ast_t *a, mpc_ast_arena_t *r) {
+  int i;
+  if (a->arena != r) { return 0; }
+  for (i = 0; i < a->children_num; i++) {
+    if (!in_arena(a->children[i], r)) { return 0; }
+  }
+  return 1;
+}
+
+/* Parses the matched text again, into another arena */
+static mpc_val_t *reparse(mpc_val_t *x) {
+  mpc_result_t r;
+  if (mpc_parse_arena("<inner>", x, strlen(x), Lisp, &r, inner)) {
+    nested = r.output;
+  } else {
+    mpc_err_delete(r.error);
+  }
+  return x;
+}
+
+static mpc_parser_t *Expr, *Sexpr;
+
+static void grammar(int flags) {
+  Expr = mpc_new("expr");
+  Sexpr = mpc_new("sexpr");
+  Lisp = mpc_new("lisp");
+  mpca_lang(flags,
+    " expr  : /-?[0-9]+/ | /[a-z]+/ | <sexpr> ; "
+    " sexpr : '(' <expr>* ')' ;                "
+    " lisp  : /^/ <expr>* /$/ ;                ",
+    Expr, Sexpr, Lisp, NULL);
+}
+
+static mpc_ast_t *parse(const char *s, mpc_ast_arena_t *a) {
+  mpc_result_t r;
+  if (mpc_parse_arena("<test>", s, strlen(s), Lisp, &r, a)) { return r.output; }
+  mpc_err_print(r.error);
+  mpc_err_delete(r.error);
+  return NULL;
+}
+
+int main(void) {
+  
+  const char *s = "(add 1 (mul 2 3)) (neg -4)";
+  int flags[2] = { MPCA_LANG_DEFAULT, MPCA_LANG_PACKRAT };
+  mpc_ast_arena_t *a = mpc_ast_arena_new();
+  mpc_ast_arena_t *b = mpc_ast_arena_new();
+  mpc_ast_t *x, *y, *z, *c;
+  mpc_parser_t *outer;
+  mpc_result_t r;
+  int i;
+  
+  for (i = 0; i < 2; i++) {
+    
+    grammar(flags[i]);
+    x = parse(s, a);
+    y = parse(s, b);
+    z = parse(s, NULL);
+    CHECK(x && y && z);
+    if (!x || !y || !z) { return 1; }
+    CHECK(in_arena(x, a));
+    CHECK(in_arena(y, b));
+    CHECK(in_arena(z, NULL));
+    CHECK(mpc_ast_eq(x, y) && mpc_ast_eq(x, z));
+    
+    c = mpc_ast_copy(x);
+    CHECK(in_arena(c, NULL));
+    mpc_ast_arena_clear(a);
+    mpc_ast_arena_clear(b);
+    CHECK(mpc_ast_eq(c, z));
+    mpc_ast_delete(c);
+    mpc_ast_delete(z);
+    if (i == 0) { mpc_cleanup(3, Expr, Sexpr, Lisp); }
+  }
+  
+  /* A parse started from a callback of another */
+  inner = b;
+  nested = NULL;
+  x = parse(s, NULL);
+  outer = mpc_apply(mpc_many1(mpcf_strfold, mpc_noneof(";")), reparse);
+  CHECK(mpc_parse("<outer>", s, outer, &r));
+  CHECK(nested && in_arena(nested, b));
+  CHECK(nested && x && mpc_ast_eq(nested, x));
+  free(r.output);
+  mpc_delete(outer);
+  mpc_ast_delete(x);
+  mpc_cleanup(3, Expr, Sexpr, Lisp);
+  
+  mpc_ast_arena_delete(a);
+  mpc_ast_arena_delete(b);
+  
+  /* Tags are interned again after a cleanup */
+  mpc_ast_tags_cleanup();
+  grammar(MPCA_LANG_DEFAULT);
+  x = parse(s, NULL);
+  CHECK(x && mpc_ast_has_tag(x->children[1], mpc_ast_tag_id("sexpr")));
+  mpc_ast_delete(x);
+  mpc_cleanup(3, Expr, Sexpr, Lisp);
+  mpc_ast_tags_cleanup();
+  
+  return failed;
+}
@@ -0,0 +1,91 @@
+/*
+** An `or` skips the alternatives that can't start
+** with the next character, but reports the same
+** errors as if it had tried them all, and runs each
+** callback once whether the parse fails or not.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("dispatch.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static int numbers = 0;
+
+static mpc_val_t *count_number(mpc_val_t *x) {
+  numbers++;
+  return x;
+}
+
+/* Checks parsing `s` fails with the message `m` */
+static void fails(mpc_parser_t *p, const char *s, const char *m) {
+  mpc_result_t r;
+  char *e;
+  if (mpc_parse("<test>", s, p, &r)) {
+    printf("dispatch.c: \"%s\" should not parse\n", s);
+    free(r.output);
+    failed = 1;
+    return;
+  }
+  e = mpc_err_string(r.error);
+  if (strcmp(e, m) != 0) {
+    printf("dispatch.c: \"%s\" gave %s", s, e);
+    failed = 1;
+  }
+  free(e);
+  mpc_err_delete(r.error);
+}
+
+int main(void) {
+
+  mpc_parser_t *Expr = mpc_new("expr");
+  mpc_parser_t *Top, *Opt, *Not;
+  mpc_result_t r;
+
+  /* expr : number | symbol | '(' expr* ')' */
+  mpc_define(Expr, mpc_or(3,
+    mpc_apply(mpc_tok(mpc_digits()), count_number),
+    mpc_tok(mpc_ident()),
+    mpc_and(3, mpcf_strfold,
+      mpc_tok(mpc_char('(')),
+      mpc_many(mpcf_strfold, Expr),
+      mpc_tok(mpc_char(')')), free, free)));
+  Top = mpc_whole(mpc_many(mpcf_strfold, Expr), free);
+
+  numbers = 0;
+  CHECK(mpc_parse("<test>", "(1 (two 3) 4)", Top, &r));
+  CHECK(numbers == 3);
+  free(r.output);
+
+  numbers = 0;
+  fails(Top, "(1 (two 3) 4 ]",
+    "<test>:1:14: error: expected whitespace, digits, letter, underscore,"
+    " '(' or ')' at ']'\n");
+  CHECK(numbers == 3);
+
+  fails(Top, "]",
+    "<test>:1:1: error: expected digits, letter, underscore, '(' or end of input"
+    " at ']'\n");
+
+  /* An empty match is found after skipping 'a', which is still expected */
+  Opt = mpc_whole(mpc_or(2,
+    mpc_and(2, mpcf_strfold, mpc_or(2, mpc_char('a'), mpc_lift(mpcf_ctor_str)), mpc_char('c'), free),
+    mpc_char('b')), free);
+  fails(Opt, "z", "<test>:1:1: error: expected 'a', 'c' or 'b' at 'z'\n");
+  fails(Opt, "ab", "<test>:1:2: error: expected 'c' at 'b'\n");
+
+  /* A lookahead sees past the character the `or` dispatches on */
+  Not = mpc_whole(mpc_or(2,
+    mpc_and(2, mpcf_strfold, mpc_not_lift(mpc_string("xy"), free, mpcf_ctor_str), mpc_char('q'), free),
+    mpc_char('r')), free);
+  fails(Not, "xz", "<test>:1:1: error: expected \"xy\", 'q' or 'r' at 'x'\n");
+  fails(Not, "xy", "<test>:1:1: error: expected opposite or 'r' at 'x'\n");
+
+  mpc_delete(Top);
+  mpc_delete(Opt);
+  mpc_delete(Not);
+  mpc_cleanup(1, Expr);
+
+  return failed;
+}
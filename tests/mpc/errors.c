@@ -0,0 +1,113 @@
+/*
+** Errors are recorded lazily and only built when a
+** parse fails, but read exactly as they did when each
+** failure built its own. The expected messages were
+** taken from mpc before it recorded errors lazily.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("errors.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static const struct { int p; const char *s; const char *e; } cases[] = {
+  /* A failure ties with an expect before it and wins */
+  { 0, "b", "<test>: error: boom\n" },
+  { 0, "", "<test>: error: boom\n" },
+  { 1, "b", "<test>: error: bad thing\n" },
+  { 1, "ax", "<test>:1:2: error: expected 'b' at 'x'\n" },
+  { 2, "abx", "<test>:1:3: error: expected end of input at 'x'\n" },
+  { 2, "x", "<test>:1:1: error: expected greeting at 'x'\n" },
+  { 3, "aa", "<test>:1:3: error: expected 3 of 'a' at end of input\n" },
+  { 3, "aab", "<test>:1:3: error: expected 3 of 'a' at 'b'\n" },
+  { 4, "xy", NULL },
+  { 4, "xz", "<test>:1:2: error: expected end of input at 'z'\n" },
+  { 4, "q", "<test>:1:1: error: expected \"xy\", 'x' or one or more of one of 'xy' at 'q'\n" },
+  { 5, "1 (2 x", "<test>:1:6: error: expected whitespace, '-', one or more of one of '0123456789', '(', '{' or ')' at 'x'\n" },
+  { 5, "(1 2))", "<test>:1:6: error: expected whitespace, '-', one or more of one of '0123456789', '(', '{' or end of input at ')'\n" },
+  { 5, "{1 2", "<test>:1:5: error: expected whitespace, '-', one or more of one of '0123456789', '(', '{' or '}' at end of input\n" },
+  { 5, "#", "<test>:1:1: error: expected whitespace, '-', one or more of one of '0123456789', '(', '{' or end of input at '#'\n" },
+  { 6, "12x", "<test>:1:3: error: expected digit or end of input at 'x'\n" },
+  { 6, "x", "<test>:1:1: error: expected one or more of digit at 'x'\n" },
+  { 7, "ab ac", NULL },
+  { 7, "abc", "<test>:1:3: error: expected whitespace, \"ab\", \"ac\" or end of input at 'c'\n" },
+  { 8, "ac", "<test>:1:2: error: expected \"ab\" or \"ac\" at 'c'\n" },
+  { 8, "b", "<test>:1:1: error: expected \"ab\" or \"ac\" at 'b'\n" },
+  { 9, "3", NULL },
+  { 9, "a3", "<test>:1:1: error: expected digit at 'a'\n" },
+  { 10, "aa", "<test>:1:2: error: expected end of input at 'a'\n" },
+  { 10, "b", "<test>: error: never\n" },
+  { 11, "-", "<test>:1:1: error: expected real at '-'\n" },
+  { 11, "1.x", "<test>:1:3: error: expected digits at 'x'\n" },
+  { 12, "x\ny\nz?", "<test>:3:2: error: expected newline at '?'\n" },
+  { -1, NULL, NULL }
+};
+
+int main(void) {
+
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Sexpr  = mpc_new("sexpr");
+  mpc_parser_t *Qexpr  = mpc_new("qexpr");
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Lisp   = mpc_new("lisp");
+  mpc_parser_t *ps[13];
+  mpc_result_t r;
+  char *e;
+  int k;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number : /-?[0-9]+/ ;                         "
+    " sexpr  : '(' <expr>* ')' ;                    "
+    " qexpr  : '{' <expr>* '}' ;                    "
+    " expr   : <number> | <sexpr> | <qexpr> ;       "
+    " lisp   : /^/ <expr>* /$/ ;                    ",
+    Number, Sexpr, Qexpr, Expr, Lisp, NULL);
+
+  ps[0] = mpc_or(2, mpc_char('a'), mpc_fail("boom"));
+  ps[1] = mpc_or(2, mpc_and(2, mpcf_strfold, mpc_char('a'), mpc_char('b'), free), mpc_failf("bad %s", "thing"));
+  ps[2] = mpc_whole(mpc_expect(mpc_string("ab"), "greeting"), free);
+  ps[3] = mpc_whole(mpc_count(3, mpcf_strfold, mpc_char('a'), free), free);
+  ps[4] = mpc_whole(mpc_or(2,
+    mpc_and(2, mpcf_strfold, mpc_not_lift(mpc_string("xy"), free, mpcf_ctor_str), mpc_char('x'), free),
+    mpc_many1(mpcf_strfold, mpc_oneof("xy"))), free);
+  ps[5] = Lisp;
+  ps[6] = mpc_whole(mpc_many1(mpcf_strfold, mpc_digit()), free);
+  ps[7] = mpc_whole(mpc_many1(mpcf_strfold, mpc_tok(mpc_or(2, mpc_string("ab"), mpc_string("ac")))), free);
+  ps[8] = mpc_whole(mpc_predictive(mpc_or(2, mpc_string("ab"), mpc_string("ac"))), free);
+  ps[9] = mpc_whole(mpc_and(2, mpcf_snd_free, mpc_boundary(), mpc_digit(), free), free);
+  ps[10] = mpc_whole(mpc_or(3,
+    mpc_expect(mpc_char('a'), "first"),
+    mpc_expect(mpc_char('a'), "first"),
+    mpc_fail("never")), free);
+  ps[11] = mpc_whole(mpc_real(), free);
+  ps[12] = mpc_whole(mpc_many(mpcf_strfold, mpc_and(2, mpcf_strfold, mpc_alpha(), mpc_newline(), free)), free);
+
+  for (k = 0; cases[k].s; k++) {
+    if (mpc_parse("<test>", cases[k].s, ps[cases[k].p], &r)) {
+      if (cases[k].e) {
+        printf("errors.c: \"%s\" should not parse\n", cases[k].s);
+        failed = 1;
+      }
+      if (cases[k].p == 5) { mpc_ast_delete(r.output); } else { free(r.output); }
+      continue;
+    }
+    e = mpc_err_string(r.error);
+    if (!cases[k].e || strcmp(e, cases[k].e) != 0) {
+      printf("errors.c: \"%s\" gave %s", cases[k].s, e);
+      failed = 1;
+    }
+    free(e);
+    mpc_err_delete(r.error);
+  }
+
+  /* The parts of an error, not just its message */
+  CHECK(!mpc_parse("<test>", "1 (2 x", Lisp, &r));
+  CHECK(r.error->expected_num == 6 && r.error->recieved == 'x' && r.error->state.pos == 5);
+  mpc_err_delete(r.error);
+
+  for (k = 0; k < 13; k++) { if (k != 5) { mpc_delete(ps[k]); } }
+  mpc_cleanup(5, Number, Sexpr, Qexpr, Expr, Lisp);
+
+  return failed;
+}
@@ -0,0 +1,168 @@
+/*
+** Memoized parsers give the same results and errors
+** as the parsers they wrap, with any memory limit,
+** and parse each rule once per input position.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("memo.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static unsigned long seed = 44;
+
+static int rnd(int n) {
+  seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+  return (int)((seed >> 8) % n);
+}
+
+static int leaves = 0;
+
+static mpc_val_t *count_leaf(mpc_val_t *x) {
+  leaves++;
+  return x;
+}
+
+static mpc_val_t *copy_str(mpc_val_t *x) {
+  char *y = malloc(strlen(x) + 1);
+  strcpy(y, x);
+  return y;
+}
+
+/* e : '(' e ')' 'x' | '(' e ')' 'y' | 'z', each level trying both */
+static mpc_parser_t *nested(int memo) {
+  mpc_parser_t *E = mpc_new("e");
+  mpc_parser_t *x = mpc_or(3,
+    mpc_and(4, mpcf_strfold, mpc_char('('), E, mpc_char(')'), mpc_char('x'), free, free, free),
+    mpc_and(4, mpcf_strfold, mpc_char('('), E, mpc_char(')'), mpc_char('y'), free, free, free),
+    mpc_apply(mpc_char('z'), count_leaf));
+  if (memo == 1) { x = mpc_memo(x, copy_str, free); }
+  if (memo == 2) { x = mpc_memo(x, NULL, free); }
+  mpc_define(E, x);
+  return E;
+}
+
+/* Parses `s` as a string, or from a file or pipe holding it */
+static int parse(int how, const char *s, mpc_parser_t *p, mpc_result_t *r) {
+  int ok;
+  FILE *f;
+  if (how == 0) { return mpc_parse("<test>", s, p, r); }
+  f = tmpfile();
+  fputs(s, f);
+  rewind(f);
+  ok = how == 1 ? mpc_parse_file("<test>", f, p, r) : mpc_parse_pipe("<test>", f, p, r);
+  fclose(f);
+  return ok;
+}
+
+/* Checks `a` and `b` agree on `s`, comparing outputs with `eq` */
+static void agree(int how, const char *s, mpc_parser_t *a, mpc_parser_t *b,
+  int(*eq)(mpc_val_t*, mpc_val_t*), mpc_dtor_t d) {
+
+  mpc_result_t r0, r1;
+  int x = parse(how, s, a, &r0);
+  int y = parse(how, s, b, &r1);
+  char *e0, *e1;
+
+  if (x != y) {
+    printf("memo.c: \"%s\" (input %d) parsed %d memoized and %d not\n", s, how, y, x);
+    failed = 1;
+  } else if (x && !eq(r0.output, r1.output)) {
+    printf("memo.c: \"%s\" (input %d) gave different outputs\n", s, how);
+    failed = 1;
+  } else if (!x) {
+    e0 = mpc_err_string(r0.error);
+    e1 = mpc_err_string(r1.error);
+    if (strcmp(e0, e1) != 0) {
+      printf("memo.c: \"%s\" (input %d) gave different errors\n%s%s", s, how, e0, e1);
+      failed = 1;
+    }
+    free(e0);
+    free(e1);
+  }
+
+  if (x) { d(r0.output); } else { mpc_err_delete(r0.error); }
+  if (y) { d(r1.output); } else { mpc_err_delete(r1.error); }
+}
+
+static int str_eq(mpc_val_t *a, mpc_val_t *b) { return strcmp(a, b) == 0; }
+static int ast_eq(mpc_val_t *a, mpc_val_t *b) { return mpc_ast_eq(a, b); }
+static void ast_delete(mpc_val_t *a) { mpc_ast_delete(a); }
+
+/* Builds a nesting `depth` deep, then breaks it at random */
+static void input(char *s, int depth, int broken) {
+  int k = 0, j;
+  for (j = 0; j < depth; j++) { s[k++] = '('; }
+  s[k++] = 'z';
+  for (j = 0; j < depth; j++) { s[k++] = ')'; s[k++] = rnd(2) ? 'x' : 'y'; }
+  if (broken) { s[rnd(k)] = "()xyzq"[rnd(6)]; }
+  s[k] = '\0';
+}
+
+int main(void) {
+
+  size_t limits[3] = { 16 * 1024 * 1024, 200, 0 };
+  mpc_parser_t *Plain, *Memo, *Fails, *Top[2], *E[2], *T[2];
+  mpc_result_t r;
+  char s[64];
+  int i, j, t, how;
+
+  Plain = nested(0);
+  Memo = nested(1);
+  Fails = nested(2);
+
+  /* Each level is parsed once rather than twice */
+  input(s, 14, 0);
+  for (t = 0; s[t]; t++) { if (s[t] == 'x') { s[t] = 'y'; } }
+  leaves = 0;
+  CHECK(mpc_parse("<test>", s, Plain, &r));
+  CHECK(leaves == 1 << 14);
+  free(r.output);
+  leaves = 0;
+  CHECK(mpc_parse("<test>", s, Memo, &r));
+  CHECK(leaves == 1);
+  free(r.output);
+
+  for (i = 0; i < 3; i++) {
+    mpc_memo_limit(limits[i]);
+    for (t = 0; t < 150; t++) {
+      input(s, rnd(12), t & 1);
+      how = t % 3;
+      agree(how, s, Plain, Memo, str_eq, free);
+      agree(how, s, Plain, Fails, str_eq, free);
+    }
+  }
+
+  mpc_cleanup(1, Plain);
+  mpc_cleanup(1, Memo);
+  mpc_cleanup(1, Fails);
+
+  /* An anchor after a memoized rule sees the character it ended on */
+  for (i = 0; i < 2; i++) {
+    E[i] = mpc_new("e");
+    T[i] = mpc_new("t");
+    Top[i] = mpc_new("top");
+    mpca_lang(i ? MPCA_LANG_PACKRAT : MPCA_LANG_DEFAULT,
+      " e   : <t> 'x' | <t> /\\b/ 'y' | <t> ';' 'y' ; "
+      " t   : '(' <e> ')' | /z+/ ;                   "
+      " top : /^/ <e>* /$/ ;                         ",
+      E[i], T[i], Top[i], NULL);
+  }
+
+  for (i = 0; i < 3; i++) {
+    mpc_memo_limit(limits[i]);
+    for (t = 0; t < 300; t++) {
+      for (j = 0; j < t % 14; j++) { s[j] = "()zxy;"[rnd(6)]; }
+      s[j] = '\0';
+      how = t % 3;
+      agree(how, s, Top[0], Top[1], ast_eq, ast_delete);
+    }
+  }
+
+  mpc_memo_limit(limits[0]);
+  mpc_cleanup(3, E[0], T[0], Top[0]);
+  mpc_cleanup(3, E[1], T[1], Top[1]);
+
+  return failed;
+}
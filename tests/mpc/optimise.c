@@ -0,0 +1,186 @@
+/*
+** An optimised grammar parses exactly as it did
+** before, giving the same outputs and errors. Each
+** random grammar is built twice from the same seed
+** and only one copy is optimised.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+static unsigned long seed;
+
+static int rnd(int n) {
+  seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+  return (int)((seed >> 8) % n);
+}
+
+static mpc_val_t *fold(int n, mpc_val_t **xs) {
+  int i;
+  char *x = calloc(1, 1);
+  for (i = 0; i < n; i++) {
+    if (!xs[i]) { continue; }
+    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
+    strcat(x, xs[i]);
+    free(xs[i]);
+  }
+  return x;
+}
+
+static void ast_delete(mpc_val_t *x) { if (x) { mpc_ast_delete(x); } }
+
+/* Some rules match without building an AST */
+static int ast_eq(mpc_val_t *a, mpc_val_t *b) {
+  if (!a || !b) { return a == b; }
+  return mpc_ast_eq(a, b);
+}
+
+static mpc_parser_t *rules[3];
+static int level, ast;
+
+/* A parser for a single character, which classes are made of */
+static mpc_parser_t *single(void) {
+  switch (rnd(4)) {
+    case 0: return mpc_char("abcxy"[rnd(5)]);
+    case 1: return mpc_oneof(rnd(2) ? "ab" : "xyz");
+    case 2: return mpc_range('a', 'c');
+    default: return mpc_expect(mpc_char("abc"[rnd(3)]), "letter");
+  }
+}
+
+static mpc_parser_t *leaf(mpc_parser_t *x) {
+  return ast ? mpca_tag(mpc_apply(x, mpcf_str_ast), "leaf") : x;
+}
+
+static mpc_parser_t *and2(mpc_parser_t *a, mpc_parser_t *b) {
+  return ast ? mpca_and(2, a, b) : mpc_and(2, fold, a, b, free);
+}
+
+static mpc_parser_t *and3(mpc_parser_t *a, mpc_parser_t *b, mpc_parser_t *c) {
+  return ast ? mpca_and(3, a, b, c) : mpc_and(3, fold, a, b, c, free, free);
+}
+
+/* Something that consumes input before `x`, so it can repeat */
+static mpc_parser_t *step(mpc_parser_t *x) {
+  return and2(leaf(mpc_oneof("abcxyz;")), x);
+}
+
+static mpc_parser_t *gen(int d) {
+  static const char *strs[] = { "ab", "ba", "c", "abc", "xy" };
+  int n;
+  switch (rnd(d > 0 ? 17 : 4)) {
+    case 0: return leaf(single());
+    case 1: return leaf(mpc_string(strs[rnd(5)]));
+    case 2: return leaf(mpc_re(rnd(2) ? "[ab]+" : "x*y"));
+    case 3:
+      if (level < 2) { return rules[level + 1 + rnd(2 - level)]; }
+      return leaf(mpc_char('z'));
+    case 4: case 5: case 6:
+      n = 2 + rnd(3);
+      if (n == 2) { return mpc_or(2, gen(d-1), gen(d-1)); }
+      if (n == 3) { return mpc_or(3, gen(d-1), gen(d-1), gen(d-1)); }
+      return mpc_or(4, gen(d-1), gen(d-1), gen(d-1), gen(d-1));
+    case 7: return mpc_or(3, leaf(single()), leaf(single()), gen(d-1));
+    case 8: return and2(gen(d-1), gen(d-1));
+    case 9: return and3(gen(d-1), gen(d-1), gen(d-1));
+    case 10: return ast ? mpca_maybe(gen(d-1)) : mpc_maybe_lift(gen(d-1), mpcf_ctor_str);
+    case 11:
+      if (ast) { return rnd(2) ? mpca_many(step(gen(d-1))) : mpca_many1(step(gen(d-1))); }
+      return rnd(2) ? mpc_many(fold, step(gen(d-1))) : mpc_many1(fold, step(gen(d-1)));
+    case 12:
+      if (ast) { return leaf(rnd(2) ? mpc_many(mpcf_strfold, single()) : mpc_many1(mpcf_strfold, single())); }
+      return rnd(2) ? mpc_many(mpcf_strfold, single()) : mpc_many1(mpcf_strfold, single());
+    case 13:
+      if (ast) { return mpca_count(2, step(gen(d-1))); }
+      return mpc_count(2, fold, step(gen(d-1)), free);
+    case 14: return mpc_expect(rnd(2) ? gen(d-1) : mpc_expect(gen(d-1), "inner"), "thing");
+    case 15: return rnd(4) ? and2(gen(d-1), leaf(mpc_char(';'))) : mpc_fail("boom");
+    default: return ast ? mpca_not(gen(d-1)) : mpc_not_lift(gen(d-1), free, mpcf_ctor_str);
+  }
+}
+
+/* Builds grammar `g`, as its rules and the top parser */
+static mpc_parser_t *grammar(int g, int optimise) {
+  int j;
+  mpc_parser_t *x, *top;
+  for (j = 0; j < 3; j++) { rules[j] = mpc_new("rule"); }
+  seed = 50 + g * 7919UL;
+  ast = g & 1;
+  for (j = 0; j < 3; j++) {
+    level = j;
+    x = gen(3);
+    /* A rule can't be defined as another directly */
+    if (x == rules[1] || x == rules[2]) { x = and2(x, leaf(mpc_char(';'))); }
+    mpc_define(rules[j], x);
+  }
+  top = ast
+    ? mpc_whole(rules[0], ast_delete)
+    : mpc_whole(rules[0], free);
+  if (optimise) {
+    for (j = 0; j < 3; j++) { mpc_optimise(rules[j]); }
+    mpc_optimise(top);
+  }
+  return top;
+}
+
+static int parse(int how, const char *s, mpc_parser_t *p, mpc_result_t *r) {
+  int ok;
+  FILE *f;
+  if (how == 0) { return mpc_parse("<test>", s, p, r); }
+  f = tmpfile();
+  fputs(s, f);
+  rewind(f);
+  ok = mpc_parse_file("<test>", f, p, r);
+  fclose(f);
+  return ok;
+}
+
+int main(void) {
+
+  mpc_parser_t *plain[3], *opt[3], *a, *b;
+  mpc_result_t r0, r1;
+  char s[16], *e0, *e1;
+  int g, t, j, x, y, same;
+
+  for (g = 0; g < 150; g++) {
+
+    a = grammar(g, 0);
+    for (j = 0; j < 3; j++) { plain[j] = rules[j]; }
+    b = grammar(g, 1);
+    for (j = 0; j < 3; j++) { opt[j] = rules[j]; }
+
+    seed = g;
+    for (t = 0; t < 40; t++) {
+      for (j = 0; j < t % 12; j++) { s[j] = "abcxyz;"[rnd(7)]; }
+      s[j] = '\0';
+      x = parse(t & 1, s, a, &r0);
+      y = parse(t & 1, s, b, &r1);
+      if (x != y) {
+        same = 0;
+      } else if (x) {
+        same = ast ? ast_eq(r0.output, r1.output) : strcmp(r0.output, r1.output) == 0;
+      } else {
+        e0 = mpc_err_string(r0.error);
+        e1 = mpc_err_string(r1.error);
+        same = strcmp(e0, e1) == 0;
+        if (!same) { printf("optimise.c: errors were\n%s%s", e0, e1); }
+        free(e0);
+        free(e1);
+      }
+      if (!same) {
+        printf("optimise.c: grammar %d parsed \"%s\" differently once optimised\n", g, s);
+        failed = 1;
+      }
+      if (x) { if (ast) { ast_delete(r0.output); } else { free(r0.output); } } else { mpc_err_delete(r0.error); }
+      if (y) { if (ast) { ast_delete(r1.output); } else { free(r1.output); } } else { mpc_err_delete(r1.error); }
+    }
+
+    mpc_delete(a);
+    mpc_delete(b);
+    mpc_cleanup(3, plain[0], plain[1], plain[2]);
+    mpc_cleanup(3, opt[0], opt[1], opt[2]);
+  }
+
+  return failed;
+}
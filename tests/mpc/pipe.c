@@ -0,0 +1,127 @@
+/*
+** Parsing from a pipe gives the same results and
+** errors as parsing the same text from a string or
+** a file, however far the parser backtracks.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("pipe.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static unsigned long seed = 46;
+
+static int rnd(int n) {
+  seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+  return (int)((seed >> 8) % n);
+}
+
+/* Parses `s` from a file, as a file or as a pipe */
+static int parse_from(int pipe, const char *s, mpc_parser_t *p, mpc_result_t *r) {
+  int ok;
+  FILE *f = tmpfile();
+  fputs(s, f);
+  rewind(f);
+  ok = pipe ? mpc_parse_pipe("<test>", f, p, r) : mpc_parse_file("<test>", f, p, r);
+  fclose(f);
+  return ok;
+}
+
+/* Checks `s` parses the same from a string, a file and a pipe */
+static void same(const char *s, mpc_parser_t *p) {
+
+  mpc_result_t r[3];
+  char *e[3];
+  int ok[3], k;
+
+  ok[0] = mpc_parse("<test>", s, p, &r[0]);
+  ok[1] = parse_from(0, s, p, &r[1]);
+  ok[2] = parse_from(1, s, p, &r[2]);
+
+  for (k = 0; k < 3; k++) { e[k] = ok[k] ? NULL : mpc_err_string(r[k].error); }
+
+  for (k = 1; k < 3; k++) {
+    if (ok[k] != ok[0]
+    || (ok[0] && !mpc_ast_eq(r[0].output, r[k].output))
+    || (!ok[0] && strcmp(e[0], e[k]) != 0)) {
+      printf("pipe.c: \"%s\" parsed differently from a %s\n", s, k == 1 ? "file" : "pipe");
+      failed = 1;
+    }
+  }
+
+  for (k = 0; k < 3; k++) {
+    if (ok[k]) { mpc_ast_delete(r[k].output); } else { mpc_err_delete(r[k].error); free(e[k]); }
+  }
+}
+
+static long lines = 0;
+
+static mpc_val_t *count_line(mpc_val_t *x) {
+  lines++;
+  free(x);
+  return NULL;
+}
+
+static mpc_val_t *fold_none(int n, mpc_val_t **xs) {
+  (void)n; (void)xs;
+  return NULL;
+}
+
+int main(void) {
+
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Symbol = mpc_new("symbol");
+  mpc_parser_t *Sexpr  = mpc_new("sexpr");
+  mpc_parser_t *Qexpr  = mpc_new("qexpr");
+  mpc_parser_t *Expr   = mpc_new("expr");
+  mpc_parser_t *Lisp   = mpc_new("lisp");
+  mpc_parser_t *Word   = mpc_new("word");
+  mpc_parser_t *Words  = mpc_new("words");
+  mpc_parser_t *Lines;
+  mpc_result_t r;
+  char s[160];
+  FILE *f;
+  int t, j, n;
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " number : /-?[0-9]+/ ;                              "
+    " symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;        "
+    " sexpr  : '(' <expr>* ')' ;                         "
+    " qexpr  : '{' <expr>* '}' ;                         "
+    " expr   : <number> | <symbol> | <sexpr> | <qexpr> ; "
+    " lisp   : /^/ <expr>* /$/ ;                         "
+    " word   : (\"ab\" 'c' | \"ab\" 'd' | /a+b*/)* ;     "
+    " words  : /^/ <word> /$/ ;                          ",
+    Number, Symbol, Sexpr, Qexpr, Expr, Lisp, Word, Words, NULL);
+
+  /* Alternatives that backtrack over bytes already read */
+  same("abd", Words);
+  same("abcabdaab", Words);
+  same("abe", Words);
+
+  for (t = 0; t < 600; t++) {
+    n = rnd(t & 1 ? 40 : 150);
+    for (j = 0; j < n; j++) { s[j] = t & 1 ? "abcd "[rnd(5)] : "(){}-12 ab+\n"[rnd(12)]; }
+    s[j] = '\0';
+    same(s, t & 1 ? Words : Lisp);
+  }
+
+  mpc_cleanup(8, Number, Symbol, Sexpr, Qexpr, Expr, Lisp, Word, Words);
+
+  /* A mark held across the whole input keeps every line */
+  Lines = mpc_and(2, fold_none,
+    mpc_many(fold_none, mpc_apply(mpc_re("[a-z0-9+(){} ]*\n"), count_line)),
+    mpc_eoi(), mpcf_dtor_null);
+
+  f = tmpfile();
+  for (j = 0; j < 5000; j++) { fputs("(add 1 {x y})\n", f); }
+  rewind(f);
+  CHECK(mpc_parse_pipe("<test>", f, Lines, &r));
+  CHECK(lines == 5000);
+  fclose(f);
+
+  mpc_delete(Lines);
+
+  return failed;
+}
@@ -0,0 +1,133 @@
+/*
+** A regex compiled to a DFA matches the same prefix
+** as the combinators it stands for, on random input
+** read from a string, a file or a pipe.
+*/
+
+#include "../../mpc.h"
+
+static int failed = 0;
+
+#define CHECK(c) if (!(c)) { printf("regex.c:%d: %s\n", __LINE__, #c); failed = 1; }
+
+static unsigned long seed = 43;
+
+static int rnd(int n) {
+  seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+  return (int)((seed >> 8) % n);
+}
+
+static mpc_parser_t *maybe(mpc_parser_t *a) { return mpc_maybe_lift(a, mpcf_ctor_str); }
+static mpc_parser_t *many(mpc_parser_t *a) { return mpc_many(mpcf_strfold, a); }
+static mpc_parser_t *many1(mpc_parser_t *a) { return mpc_many1(mpcf_strfold, a); }
+
+static mpc_parser_t *and2(mpc_parser_t *a, mpc_parser_t *b) {
+  return mpc_and(2, mpcf_strfold, a, b, free);
+}
+
+static mpc_parser_t *and3(mpc_parser_t *a, mpc_parser_t *b, mpc_parser_t *c) {
+  return mpc_and(3, mpcf_strfold, a, b, c, free, free);
+}
+
+/* Builds the combinators regex `k` stands for */
+static mpc_parser_t *combinators(int k) {
+  switch (k) {
+    case 0: return and2(maybe(mpc_char('-')), many1(mpc_digit()));
+    case 1: return many1(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_+-*/\\=<>!&"));
+    case 2: return and2(many(mpc_char('a')), mpc_char('b'));
+    case 3: return many(mpc_string("ab"));
+    case 4: return mpc_or(3, mpc_char('a'), mpc_char('b'), mpc_char('c'));
+    case 5: return and3(maybe(mpc_char('a')), maybe(mpc_char('b')), mpc_char('c'));
+    case 6: return and2(many(mpc_oneof("ab")), mpc_char('c'));
+    case 7: return many1(mpc_noneof("a"));
+    case 8: return and2(many1(mpc_or(2, mpc_char('a'), mpc_string("bc"))), maybe(mpc_char('d')));
+    case 9: return and3(many1(mpc_digit()), mpc_char('.'), many(mpc_digit()));
+    case 10: return and3(mpc_char('x'), many(mpc_oneof("yz")), maybe(mpc_or(2, mpc_string("ab"), mpc_char('c'))));
+    case 11: return and2(many(mpc_range('a', 'c')), mpc_range('d', 'f'));
+    case 12: return mpc_or(2, and2(many1(mpc_char('a')), many1(mpc_char('b'))), mpc_char('c'));
+    case 13: return and2(mpc_or(2, mpc_char('a'), mpc_lift(mpcf_ctor_str)), mpc_char('b'));
+    case 14: return mpc_or(2, mpc_char('\n'), many1(mpc_char('\t')));
+    case 15: return many1(mpc_char(']'));
+    /* These can't be compiled and keep the parser */
+    case 16: return and2(many(mpc_string("ab")), mpc_char('a'));
+    case 17: return mpc_count(2, mpcf_strfold, mpc_char('a'), free);
+    default: return NULL;
+  }
+}
+
+static const char *res[] = {
+  "-?[0-9]+", "[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+", "a*b", "(ab)*", "a|b|c",
+  "a?b?c", "(a|b)*c", "[^a]+", "(a|bc)+d?", "\\d+\\.\\d*", "x(y|z)*(ab|c)?",
+  "[a-c]*[d-f]", "a+b+|c", "(a|)b", "\\n|\\t+", "[\\]]+", "(ab)*a", "a{2}",
+  NULL
+};
+
+/* Parses `s` as a string, or from a file or pipe holding it */
+static int parse(int how, const char *s, mpc_parser_t *p, mpc_result_t *r) {
+  int ok;
+  FILE *f;
+  if (how == 0) { return mpc_parse("<test>", s, p, r); }
+  f = tmpfile();
+  fputs(s, f);
+  rewind(f);
+  ok = how == 1 ? mpc_parse_file("<test>", f, p, r) : mpc_parse_pipe("<test>", f, p, r);
+  fclose(f);
+  return ok;
+}
+
+int main(void) {
+
+  const char *chars = "abcdefxyz019-_.]*\\\n\t ";
+  mpc_parser_t *re, *x;
+  mpc_result_t r0, r1;
+  mpc_span_t *span;
+  int k, t, j, how, a, b;
+  char in[16];
+
+  for (k = 0; res[k]; k++) {
+    re = mpc_re(res[k]);
+    x = combinators(k);
+    for (t = 0; t < 300; t++) {
+      for (j = 0; j < t % 12; j++) { in[j] = chars[rnd(strlen(chars))]; }
+      in[j] = '\0';
+      how = t % 3;
+      a = parse(how, in, re, &r0);
+      b = parse(how, in, x, &r1);
+      if (a != b || (a && strcmp(r0.output, r1.output) != 0)) {
+        printf("regex.c: /%s/ on \"%s\" gave %s, combinators %s\n", res[k], in,
+          a ? (char*)r0.output : "an error", b ? (char*)r1.output : "an error");
+        failed = 1;
+      }
+      if (a) { free(r0.output); } else { mpc_err_delete(r0.error); }
+      if (b) { free(r1.output); } else { mpc_err_delete(r1.error); }
+    }
+    mpc_delete(re);
+    mpc_delete(x);
+  }
+
+  /* The tokens the RyLisp reader uses */
+  re = mpc_re("-?[0-9]+");
+  CHECK(mpc_parse("<test>", "-12x", re, &r0) && strcmp(r0.output, "-12") == 0);
+  free(r0.output);
+  CHECK(!mpc_parse("<test>", "-x", re, &r0));
+  mpc_err_delete(r0.error);
+  mpc_delete(re);
+
+  /* A span of a regex reads the same from any input */
+  re = mpc_span(mpc_re("[a-c]+"));
+  for (how = 0; how < 3; how++) {
+    CHECK(parse(how, "abcx", re, &r0));
+    span = r0.output;
+    CHECK(span->length == 3 && strncmp(span->data, "abc", 3) == 0);
+    mpc_span_delete(span);
+  }
+  mpc_delete(re);
+
+  /* A NUL byte is left to the parser, which matches through it */
+  re = mpc_re("[^a]+");
+  CHECK(mpc_parse_buffer("<test>", "b\0ca", 4, re, &r0) && strcmp(r0.output, "bc") == 0);
+  free(r0.output);
+  mpc_delete(re);
+
+  return failed;
+}
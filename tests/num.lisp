@@ -0,0 +1,18 @@
+(def {fib} (\ {n} {if (< n 2) {n} {+ (fib (- n 1)) (fib (- n 2))}}))
+(def {d} (\ {n} {if (< n 0) {d n} {/ 10 n}}))
+(def {q} {1})
+(fib 5)
+(fib 6)
+(d 2)
+(d 5)
+(+ 1 (fib 10))
+(+ 1 (/ 5 0))
+(+ (fib 10) (d 0))
+(* 2 (d 0) (fib 3))
+(- (fib 10))
+(== (fib 10) q)
+(!= (fib 3) {1})
+(+ (fib 10) q)
+(+ (+ (+ (+ (+ (+ (+ (+ (fib 24) q) q) q) q) q) q) q) q)
+(< (fib 10) (fib 11))
+(d (- (fib 3) 2))
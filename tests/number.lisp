@@ -0,0 +1,8 @@
+9223372036854775807
+9223372036854775808
+-9223372036854775808
+-9223372036854775809
+99999999999999999999999999
+-99999999999999999999999
+(+ 9223372036854775807 0)
+(- -9223372036854775808 0)
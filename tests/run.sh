@@ -0,0 +1,86 @@
+#!/bin/sh
+# Regression tests. Each tests/*.lisp is fed to the REPL, and the values
+# it prints must match tests/*.out, with every reader. Where the readers
+# word an error differently, tests/*--mpc.out and tests/*--mpc-ast.out
+# hold what those print instead. Each file is also run as a program,
+# which must not crash, and the hot lambdas in tests/jit.lisp must show
+# up in the perf map of the JIT. Each tests/emit/*.lisp is compiled with
+# --emit-c and must print what the interpreter prints, and each
+# tests/mpc/*.c is a program testing mpc on its own.
+#
+#   tests/run.sh [rylisp]
+#
+# Without a binary one is built from the sources with $CC, $CFLAGS and
+# $LIBS.
+
+cd "$(dirname "$0")/.." || exit 1
+bin=$1
+libs=${LIBS:--ledit -lm}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+if [ -z "$bin" ]; then
+	bin=$tmp/rylisp
+	${CC:-cc} -std=c99 -O2 $CFLAGS parsing.c mpc.c $libs -o "$bin" || exit 1
+fi
+
+fail=0
+for f in tests/*.lisp; do
+	for mode in "" --mpc --mpc-ast; do
+		#keep only the values printed, not the banner or the prompts
+		"$bin" $mode < "$f" 2>&1 | grep -v '^RyLisp\|^Press Ctrl-C\|^$' > "$tmp/out"
+		want=${f%.lisp}$mode.out
+		[ -f "$want" ] || want=${f%.lisp}.out
+		if ! cmp -s "$tmp/out" "$want"; then
+			echo "FAIL $f $mode"
+			diff "$want" "$tmp/out" | head -20
+			fail=1
+		fi
+	done
+	"$bin" "$f" > /dev/null 2>&1
+	if [ $? -ge 128 ]; then
+		echo "FAIL $f crashed when run as a program"
+		fail=1
+	fi
+done
+
+#on x86-64 the lambdas tests/jit.lisp makes hot must reach native code,
+#which perf learns of from /tmp/perf-<pid>.map
+if [ "$(uname -m)" = x86_64 ]; then
+	"$bin" < tests/jit.lisp > /dev/null 2>&1 &
+	pid=$!
+	wait $pid
+	for name in addk quot; do
+		if ! grep -q " rylisp:$name\$" "/tmp/perf-$pid.map" 2>/dev/null; then
+			echo "FAIL tests/jit.lisp did not compile $name"
+			fail=1
+		fi
+	done
+	rm -f "/tmp/perf-$pid.map"
+fi
+
+for f in tests/emit/*.lisp; do
+	"$bin" "$f" > "$tmp/want" 2>&1
+	if ! "$bin" --emit-c "$f" > "$tmp/emit.c" \
+		|| ! ${CC:-cc} -std=c99 -O2 $CFLAGS -DRYLISP_NO_MAIN -I. "$tmp/emit.c" parsing.c mpc.c $libs -o "$tmp/emit"; then
+		echo "FAIL $f does not compile"
+		fail=1
+		continue
+	fi
+	"$tmp/emit" > "$tmp/out" 2>&1
+	if ! cmp -s "$tmp/out" "$tmp/want"; then
+		echo "FAIL $f --emit-c"
+		diff "$tmp/want" "$tmp/out" | head -20
+		fail=1
+	fi
+done
+
+for f in tests/mpc/*.c; do
+	if ! ${CC:-cc} -std=c89 $CFLAGS "$f" mpc.c -lm -o "$tmp/mpc" || ! "$tmp/mpc"; then
+		echo "FAIL $f"
+		fail=1
+	fi
+done
+
+[ $fail = 0 ] && echo "all tests passed"
+exit $fail